@@ -1,15 +1,252 @@
 #include "async_tests.h"
 #include "utils.hpp"
 
+#include <atomic>
 #include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
 #include <threadpp/future.hpp>
+#include <vector>
 
 namespace async_tests
 {
 using namespace std::chrono_literals;
 
+void run_default_executor_test(int count)
+{
+	std::mutex guard;
+	std::set<tpp::thread::id> used_threads;
+	auto record_thread = [&]()
+	{
+		std::lock_guard<std::mutex> lock(guard);
+		used_threads.insert(tpp::this_thread::get_id());
+	};
+
+	// one after another, the same few executor threads should be reused
+	for(int i = 0; i < count; ++i)
+	{
+		auto result = tpp::async(
+						  [&](int value)
+						  {
+							  record_thread();
+							  return value;
+						  },
+						  i)
+						  .then(
+							  [&](auto parent)
+							  {
+								  record_thread();
+								  return parent.get() * 2;
+							  })
+						  .get();
+		if(result != i * 2)
+		{
+			throw std::runtime_error("default executor returned a wrong result");
+		}
+	}
+
+	if(used_threads.size() >= static_cast<size_t>(count))
+	{
+		throw std::runtime_error("default executor does not reuse its threads");
+	}
+
+	// many at once, all of them must complete
+	std::vector<tpp::future<int>> futures;
+	for(int i = 0; i < count; ++i)
+	{
+		futures.emplace_back(tpp::async(
+			[&](int value)
+			{
+				record_thread();
+				return value;
+			},
+			i));
+	}
+	for(int i = 0; i < count; ++i)
+	{
+		if(futures[static_cast<size_t>(i)].get() != i)
+		{
+			throw std::runtime_error("default executor returned a wrong result");
+		}
+	}
+
+	sout() << "default executor used " << used_threads.size() << " threads for " << count * 3 << " tasks\n";
+}
+
+void run_executor_reuse_test(int count)
+{
+	// one after another, each task finds the thread of the previous one idle
+	std::set<tpp::thread::id> used_threads;
+	for(int i = 0; i < count; ++i)
+	{
+		used_threads.insert(tpp::async([]() { return tpp::this_thread::get_id(); }).get());
+	}
+
+	sout() << "default executor used " << used_threads.size() << " threads for " << count << " sequential tasks\n";
+	if(used_threads.size() > 2)
+	{
+		throw std::runtime_error("default executor spawned a thread per sequential task");
+	}
+}
+
+void run_executor_handoff_test(int count, std::chrono::milliseconds idle_timeout)
+{
+	// the idle executor threads time out right when tasks are handed to them.
+	// Each task must still get a thread of its own, or the first would
+	// never see the second run
+	for(int i = 0; i < count; ++i)
+	{
+		std::this_thread::sleep_for(idle_timeout - 1ms + std::chrono::microseconds(i % 8 * 250));
+
+		std::atomic<bool> second_ran{false};
+		auto first = tpp::async(
+			[&]()
+			{
+				auto deadline = tpp::clock::now() + 5s;
+				while(!second_ran && tpp::clock::now() < deadline)
+				{
+					std::this_thread::yield();
+				}
+				return second_ran.load();
+			});
+		auto second = tpp::async(
+			[&]()
+			{
+				second_ran = true;
+			});
+
+		second.wait();
+		if(!first.get())
+		{
+			throw std::runtime_error("default executor queued a task behind another one");
+		}
+	}
+}
+
+void run_handle_test(int iterations)
+{
+	auto thread = tpp::make_thread();
+	auto handle = thread.get_handle();
+	auto thread_id = thread.get_id();
+
+	for(int i = 0; i < iterations; ++i)
+	{
+		auto future = tpp::async(
+			handle,
+			[thread_id](int value)
+			{
+				if(tpp::this_thread::get_id() != thread_id)
+				{
+					throw std::runtime_error("async via a handle ran on another thread");
+				}
+				if(value % 10 == 0)
+				{
+					throw std::runtime_error("propagated exception");
+				}
+				return value;
+			},
+			i);
+
+		try
+		{
+			if(future.get() != i)
+			{
+				throw std::logic_error("async via a handle returned a wrong result");
+			}
+		}
+		catch(const std::runtime_error& e)
+		{
+			if(i % 10 != 0)
+			{
+				throw;
+			}
+		}
+	}
+
+	// an expired handle fails instead of running
+	thread.join();
+	if(!handle.expired())
+	{
+		throw std::runtime_error("handle of a joined thread did not expire");
+	}
+	auto future = tpp::async(handle, []() { return 1; });
+	try
+	{
+		future.get();
+		throw std::logic_error("async via an expired handle ran");
+	}
+	catch(const std::future_error&)
+	{
+	}
+}
+
+void run_inline_continuation_test(int chain_length)
+{
+	auto worker = tpp::make_thread();
+	auto worker_id = worker.get_id();
+
+	tpp::promise<int> prom;
+	auto first = prom.get_future();
+
+	std::atomic<int> ran_on_setter{0};
+	auto chain = first.then(tpp::launch_inline,
+							[&](auto parent)
+							{
+								if(tpp::this_thread::get_id() == worker_id)
+								{
+									ran_on_setter++;
+								}
+								return parent.get() + 1;
+							});
+
+	// longer than the depth limit so that part of it gets requeued
+	for(int i = 1; i < chain_length; ++i)
+	{
+		chain = chain.then(tpp::launch_inline,
+						   [](auto parent)
+						   {
+							   return parent.get() + 1;
+						   });
+	}
+
+	tpp::invoke(worker_id,
+				[p = std::move(prom)]() mutable
+				{
+					p.set_value(0);
+				});
+
+	if(chain.get() != chain_length)
+	{
+		throw std::runtime_error("inline continuation chain returned a wrong result");
+	}
+	if(ran_on_setter != 1)
+	{
+		throw std::runtime_error("inline continuation did not run on the setting thread");
+	}
+
+	// already ready, runs right away on the attaching thread
+	auto this_id = tpp::this_thread::get_id();
+	auto ready = tpp::make_ready_future(1).then(tpp::launch_inline,
+												 [this_id](auto parent)
+												 {
+													 return tpp::this_thread::get_id() == this_id ? parent.get() : -1;
+												 });
+	if(!ready.is_ready() || ready.get() != 1)
+	{
+		throw std::runtime_error("inline continuation of a ready future did not run right away");
+	}
+}
+
 void run_tests(int iterations)
 {
+	run_default_executor_test(iterations * 4);
+	run_executor_reuse_test(iterations);
+	run_executor_handoff_test(iterations, executor_idle_timeout);
+	run_inline_continuation_test(iterations * 20);
+	run_handle_test(iterations);
+
 	auto thread1 = tpp::make_thread();
 	auto thread2 = tpp::make_thread();
 
@@ -1,6 +1,10 @@
 #pragma once
+#include <chrono>
 
 namespace async_tests
 {
+// configured as the idle timeout of the default executor
+constexpr std::chrono::milliseconds executor_idle_timeout{10};
+
 void run_tests(int iterations);
 }
@@ -2,16 +2,180 @@
 #include "utils.hpp"
 
 #include <threadpp/future.hpp>
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 namespace future_promise_tests
 {
 using namespace std::chrono_literals;
+
+// move only and not default constructible, counts live instances
+struct tracked_value
+{
+	static std::atomic<int>& instances()
+	{
+		static std::atomic<int> count{0};
+		return count;
+	}
+
+	explicit tracked_value(int v) : value(std::make_unique<int>(v))
+	{
+		instances()++;
+	}
+	tracked_value(tracked_value&& rhs) noexcept : value(std::move(rhs.value))
+	{
+		instances()++;
+	}
+	tracked_value(const tracked_value&) = delete;
+	~tracked_value()
+	{
+		instances()--;
+	}
+
+	std::unique_ptr<int> value;
+};
+
+void run_value_lifetime_test(tpp::thread::id th_id)
+{
+	{
+		tpp::promise<tracked_value> prom;
+		auto fut = prom.get_future();
+		tpp::invoke(th_id, [p = std::move(prom)]() mutable { p.set_value(tracked_value(7)); });
+
+		auto val = fut.get();
+		if(!val.value || *val.value != 7)
+		{
+			throw std::runtime_error("future returned a wrong value");
+		}
+	}
+
+	{
+		tpp::promise<tracked_value> prom;
+		auto fut = prom.get_future().share();
+		prom.set_value(tracked_value(3));
+		if(*fut.get().value != 3 || *fut.get().value != 3)
+		{
+			throw std::runtime_error("shared_future returned a wrong value");
+		}
+	}
+
+	{
+		// never set, the state must not destroy a value it does not hold
+		tpp::promise<tracked_value> prom;
+		auto fut = prom.get_future();
+	}
+
+	if(tracked_value::instances() != 0)
+	{
+		throw std::runtime_error("future state leaked or double destroyed its value");
+	}
+}
+
+void run_continuation_race_test(tpp::thread::id th_id, int iterations)
+{
+	// continuations attached while the value is being set must
+	// each run exactly once, either by the setter or directly
+	for(int i = 0; i < iterations; ++i)
+	{
+		tpp::promise<int> prom;
+		auto fut = prom.get_future().share();
+
+		tpp::invoke(th_id, [p = std::move(prom), i]() mutable { p.set_value(i); });
+
+		std::vector<tpp::future<int>> continuations;
+		for(int j = 0; j < 8; ++j)
+		{
+			continuations.emplace_back(fut.then(th_id, [j](auto parent) { return parent.get() + j; }));
+		}
+
+		for(int j = 0; j < 8; ++j)
+		{
+			if(continuations[static_cast<size_t>(j)].get() != i + j)
+			{
+				throw std::runtime_error("continuation returned a wrong result");
+			}
+		}
+	}
+}
+
+void run_unregistered_wait_test(tpp::thread::id th_id, int iterations)
+{
+	// a plain std::thread can neither process tasks nor be notified,
+	// it has to block on the future itself
+	std::thread waiter([&]()
+	{
+		for(int i = 0; i < iterations; ++i)
+		{
+			auto fut = tpp::async(th_id, [i]() { return i; });
+			if(fut.get() != i)
+			{
+				throw std::runtime_error("future returned a wrong value");
+			}
+		}
+
+		tpp::promise<void> never_set;
+		auto fut = never_set.get_future();
+		if(fut.wait_for(5ms) != std::future_status::timeout)
+		{
+			throw std::runtime_error("wait_for on an unset future did not time out");
+		}
+
+		auto slow = tpp::async(th_id, []() { tpp::this_thread::sleep_for(5ms); });
+		if(slow.wait_for(10s) != std::future_status::ready)
+		{
+			throw std::runtime_error("wait_for did not wake up when the value was set");
+		}
+	});
+	waiter.join();
+}
+
+void run_exit_wait_test()
+{
+	// the value is never set, the wait ends with the exit notification
+	tpp::promise<int> never_set;
+	auto fut = never_set.get_future().share();
+	std::atomic<bool> waiting{false};
+	std::atomic<bool> rejected{false};
+
+	auto th = tpp::make_thread();
+	tpp::invoke(th.get_id(), [fut, &waiting, &rejected]() {
+		waiting = true;
+		try
+		{
+			fut.get();
+		}
+		catch(const std::runtime_error&)
+		{
+			rejected = true;
+		}
+	});
+	while(!waiting)
+	{
+		std::this_thread::yield();
+	}
+	tpp::notify_for_exit(th.get_id());
+	th.join();
+
+	if(!rejected)
+	{
+		throw std::runtime_error("get returned a result which is not ready");
+	}
+}
+
 void run_tests(int iterations)
 {
 	auto thread = tpp::make_thread();
 	auto th_id = thread.get_id();
 
+	run_value_lifetime_test(th_id);
+	run_continuation_race_test(th_id, iterations * 10);
+	run_unregistered_wait_test(th_id, iterations * 10);
+	run_exit_wait_test();
+
 	for(int i = 0; i < iterations; ++i)
 	{
 		tpp::promise<int> prom;
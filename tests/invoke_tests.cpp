@@ -2,7 +2,11 @@
 #include "utils.hpp"
 
 #include <threadpp/thread.h>
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
 
 namespace invoke_tests
 {
@@ -46,8 +50,362 @@ tpp::thread::id create_detached_itc_thread()
 	return th.get_id();
 }
 
+void run_producers_test(int iterations)
+{
+	auto consumer = tpp::make_thread();
+	auto consumer_id = consumer.get_id();
+	std::atomic<int> received{0};
+
+	const int producers_count = 32;
+	std::vector<std::thread> producers;
+	producers.reserve(producers_count);
+	for(int i = 0; i < producers_count; ++i)
+	{
+		producers.emplace_back([&]() {
+			for(int j = 0; j < iterations; ++j)
+			{
+				tpp::invoke(consumer_id, [&received]() { received++; });
+			}
+		});
+	}
+
+	for(auto& producer : producers)
+	{
+		producer.join();
+	}
+
+	while(tpp::get_pending_task_count(consumer_id) > 0)
+	{
+		std::this_thread::yield();
+	}
+
+	sout() << "received " << received << " tasks from " << producers_count << " producers";
+	if(received != producers_count * iterations)
+	{
+		throw std::runtime_error("lost tasks");
+	}
+}
+
+void run_handle_test(int iterations)
+{
+	tpp::thread_handle handle;
+	{
+		auto th = tpp::make_thread();
+		handle = th.get_handle();
+
+		std::atomic<int> received{0};
+		for(int i = 0; i < iterations; ++i)
+		{
+			tpp::invoke(handle, [&received](int arg) { received += arg; }, 1);
+		}
+
+		while(tpp::get_pending_task_count(handle.get_id()) > 0)
+		{
+			std::this_thread::yield();
+		}
+		sout() << "received " << received << " tasks via handle";
+		if(received != iterations)
+		{
+			throw std::runtime_error("lost tasks");
+		}
+	}
+
+	if(!handle.expired() || tpp::invoke(handle, []() {}))
+	{
+		throw std::runtime_error("invoked into an unregistered thread");
+	}
+}
+
+void run_move_only_test()
+{
+	auto th = tpp::make_thread();
+	std::atomic<int> received{0};
+
+	// move-only callables and arguments
+	auto value = std::make_unique<int>(1);
+	tpp::invoke(th.get_id(), [&received, value = std::move(value)]() { received += *value; });
+	tpp::invoke(th.get_id(), [&received](std::unique_ptr<int> arg) { received += *arg; }, std::make_unique<int>(2));
+
+	while(tpp::get_pending_task_count(th.get_id()) > 0)
+	{
+		std::this_thread::yield();
+	}
+
+	sout() << "received " << received << " from move-only tasks";
+	if(received != 3)
+	{
+		throw std::runtime_error("move-only tasks were not invoked");
+	}
+}
+
+void run_bulk_test(int iterations)
+{
+	auto th = tpp::make_thread();
+	std::atomic<int> received{0};
+	std::atomic<bool> in_order{true};
+
+	std::vector<std::function<void()>> callables;
+	for(int i = 0; i < iterations; ++i)
+	{
+		callables.emplace_back([&received, &in_order, i]() {
+			if(received++ != i)
+			{
+				in_order = false;
+			}
+		});
+	}
+	auto accepted = tpp::invoke_bulk(th.get_id(), callables);
+
+	// move-only tasks via the iterator form
+	std::vector<tpp::task> tasks;
+	for(int i = 0; i < iterations; ++i)
+	{
+		tasks.emplace_back([&received]() { received++; });
+	}
+	accepted += tpp::invoke_bulk(th.get_handle(),
+								 std::make_move_iterator(tasks.begin()),
+								 std::make_move_iterator(tasks.end()));
+
+	while(tpp::get_pending_task_count(th.get_id()) > 0)
+	{
+		std::this_thread::yield();
+	}
+
+	sout() << "accepted " << accepted << " bulk tasks, received " << received;
+	if(accepted != size_t(iterations) * 2 || received != iterations * 2 || !in_order)
+	{
+		throw std::runtime_error("bulk invoke lost or reordered tasks");
+	}
+}
+
+void run_priority_test(int iterations)
+{
+	auto th = tpp::make_thread();
+	std::atomic<bool> blocked{true};
+	std::vector<int> order;
+
+	// keep the thread busy until everything is queued
+	tpp::invoke(th.get_id(), [&blocked]() {
+		while(blocked)
+		{
+			std::this_thread::yield();
+		}
+	});
+
+	for(int i = 0; i < iterations; ++i)
+	{
+		tpp::invoke(th.get_id(), [&order, i]() { order.push_back(i); });
+	}
+	tpp::invoke(th.get_id(), tpp::priority::category::high, [&order]() { order.push_back(-2); });
+	tpp::invoke(th.get_handle(), tpp::priority::category::critical, [&order]() { order.push_back(-1); });
+	tpp::invoke(th.get_id(), tpp::priority::category::high, [&order]() { order.push_back(-3); });
+	blocked = false;
+
+	while(tpp::get_pending_task_count(th.get_id()) > 0)
+	{
+		std::this_thread::yield();
+	}
+
+	std::vector<int> expected{-1, -2, -3};
+	for(int i = 0; i < iterations; ++i)
+	{
+		expected.push_back(i);
+	}
+	sout() << "received " << order.size() << " prioritized tasks";
+	if(order != expected)
+	{
+		throw std::runtime_error("urgent tasks were not drained first");
+	}
+}
+
+// keeps the thread busy until the returned flag is cleared
+std::shared_ptr<std::atomic<bool>> block_thread(tpp::thread::id id)
+{
+	auto blocked = std::make_shared<std::atomic<bool>>(true);
+	auto started = std::make_shared<std::atomic<bool>>(false);
+	tpp::invoke(id, [blocked, started]() {
+		*started = true;
+		while(*blocked)
+		{
+			std::this_thread::yield();
+		}
+	});
+
+	// once running it no longer takes a place in the mailbox
+	while(!*started)
+	{
+		std::this_thread::yield();
+	}
+	return blocked;
+}
+
+void wait_idle(tpp::thread::id id)
+{
+	while(tpp::get_pending_task_count(id) > 0)
+	{
+		std::this_thread::yield();
+	}
+}
+
+void run_capacity_test(tpp::overflow_policy policy, int iterations)
+{
+	auto th = tpp::make_thread();
+	tpp::tasks_capacity_config config;
+	config.max_tasks = 4;
+	config.overflow = policy;
+	tpp::set_thread_config(th.get_id(), config);
+	wait_idle(th.get_id());
+
+	// only read once the thread is idle again
+	std::vector<int> received;
+	std::atomic<int> accepted{0};
+	auto blocked = block_thread(th.get_id());
+
+	std::thread producer([&]() {
+		for(int i = 0; i < iterations; ++i)
+		{
+			if(tpp::invoke(th.get_id(), [&received, i]() { received.push_back(i); }))
+			{
+				accepted++;
+			}
+		}
+	});
+
+	if(policy == tpp::overflow_policy::block)
+	{
+		while(accepted < int(config.max_tasks))
+		{
+			std::this_thread::yield();
+		}
+		if(tpp::try_invoke(th.get_id(), []() {}))
+		{
+			throw std::runtime_error("try_invoke did not fail on a full mailbox");
+		}
+	}
+	else
+	{
+		producer.join();
+	}
+
+	*blocked = false;
+	if(producer.joinable())
+	{
+		producer.join();
+	}
+	wait_idle(th.get_id());
+
+	sout() << "capacity " << config.max_tasks << " accepted " << accepted << " and ran " << received.size()
+		   << " of " << iterations << " tasks";
+
+	std::vector<int> expected;
+	switch(policy)
+	{
+		case tpp::overflow_policy::block:
+			for(int i = 0; i < iterations; ++i)
+			{
+				expected.push_back(i);
+			}
+			break;
+		case tpp::overflow_policy::fail:
+			for(int i = 0; i < int(config.max_tasks); ++i)
+			{
+				expected.push_back(i);
+			}
+			break;
+		case tpp::overflow_policy::drop_oldest:
+			for(int i = iterations - int(config.max_tasks); i < iterations; ++i)
+			{
+				expected.push_back(i);
+			}
+			break;
+	}
+	if(received != expected)
+	{
+		throw std::runtime_error("bounded mailbox did not honor its overflow policy");
+	}
+}
+
+void run_blocked_exit_test()
+{
+	auto th = tpp::make_thread();
+	tpp::tasks_capacity_config config;
+	config.max_tasks = 1;
+	tpp::set_thread_config(th.get_id(), config);
+	wait_idle(th.get_id());
+
+	auto blocked = block_thread(th.get_id());
+	tpp::invoke(th.get_id(), []() {});
+
+	// must be released once the thread unregisters
+	std::thread producer([&]() { tpp::invoke(th.get_id(), []() {}); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	tpp::notify_for_exit(th.get_id());
+	*blocked = false;
+	th.join();
+	producer.join();
+}
+
+void run_pool_test()
+{
+	auto th = tpp::make_thread();
+	tpp::tasks_capacity_config config;
+	config.default_reserved_tasks = 8;
+	config.capacity_shrink_threashold = 32;
+	tpp::set_thread_config(th.get_id(), config);
+	wait_idle(th.get_id());
+
+	auto count = config.capacity_shrink_threashold * 10;
+	auto blocked = block_thread(th.get_id());
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		tpp::invoke(th.get_id(), []() {});
+	}
+	auto queued = tpp::get_pending_task_count_detailed(th.get_id()).memory_usage;
+
+	*blocked = false;
+	wait_idle(th.get_id());
+	auto pooled = tpp::get_pending_task_count_detailed(th.get_id()).memory_usage;
+
+	sout() << "mailbox memory with " << count << " queued tasks " << queued << " bytes, once drained " << pooled
+		   << " bytes";
+
+	// each lane keeps only up to the shrink threshold once the tasks ran
+	if(queued == 0 || pooled * 4 > queued)
+	{
+		throw std::runtime_error("mailbox did not shrink its task pool");
+	}
+	th.join();
+}
+
+void run_unregistered_config_test()
+{
+	bool configured = true;
+	std::thread unregistered([&]() {
+		// has no context of its own to apply it to
+		configured = tpp::set_thread_config(tpp::this_thread::get_id(), {});
+	});
+	unregistered.join();
+
+	if(configured || tpp::set_thread_config(tpp::invalid_id(), {}))
+	{
+		throw std::runtime_error("configured an invalid thread");
+	}
+}
+
 void run_tests(int iterations)
 {
+	run_producers_test(iterations);
+	run_handle_test(iterations);
+	run_move_only_test();
+	run_bulk_test(iterations);
+	run_priority_test(iterations);
+	run_capacity_test(tpp::overflow_policy::fail, iterations);
+	run_capacity_test(tpp::overflow_policy::drop_oldest, iterations);
+	run_capacity_test(tpp::overflow_policy::block, iterations);
+	run_blocked_exit_test();
+	run_pool_test();
+	run_unregistered_config_test();
+
 	auto std_thread = make_std_thread();
 	auto std_thread_mapped_id = tpp::register_thread(std_thread.get_id());
 	auto std_thread_detached_mapped_id = make_detached_std_thread();
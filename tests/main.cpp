@@ -6,7 +6,9 @@
 #include "fututre_promise_tests.h"
 #include "invoke_tests.h"
 #include "overhead_tests.h"
+#include "parallel_tests.h"
 #include "thread_pool_tests.h"
+#include "timer_tests.h"
 
 #include "utils.hpp"
 #include <iostream>
@@ -18,6 +20,7 @@ int main()
 	tpp::init_data data;
 	data.log_error = [](const std::string& msg) { sout() << msg << "\n"; };
     data.log_info = [](const std::string& msg) { sout() << msg << "\n"; };
+	data.default_executor.idle_timeout = async_tests::executor_idle_timeout;
 	tpp::init(data);
 
     overhead_tests::run_tests();
@@ -27,6 +30,8 @@ int main()
     async_tests::run_tests(50);
     when_tests::run_tests(50);
     thread_pool_tests::run_tests(50);
+    parallel_tests::run_tests(50);
+    timer_tests::run_tests(50);
 
 	tpp::shutdown();
 	return 0;
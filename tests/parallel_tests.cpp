@@ -0,0 +1,147 @@
+#include "parallel_tests.h"
+#include "utils.hpp"
+
+#include <threadpp/parallel.hpp>
+#include <threadpp/when_all_any.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace parallel_tests
+{
+
+template<typename F>
+double measure_ms(F&& f)
+{
+	auto start = tpp::clock::now();
+	f();
+	auto end = tpp::clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void run_correctness_tests(tpp::thread_pool& pool, int iterations)
+{
+	const int count = iterations * 1000;
+
+	std::vector<std::atomic<int>> visits(static_cast<size_t>(count));
+	tpp::parallel_for(pool, 0, count, [&visits](int i) { visits[size_t(i)]++; });
+	for(auto& v : visits)
+	{
+		if(v != 1)
+		{
+			throw std::runtime_error("parallel_for visited an index other than once");
+		}
+	}
+
+	std::vector<int> values(static_cast<size_t>(count));
+	std::iota(values.begin(), values.end(), 0);
+	tpp::parallel_for(pool, values.begin(), values.end(), 7, [](int& v) { v *= 2; });
+
+	auto sum = tpp::parallel_reduce(pool, values.begin(), values.end(), std::int64_t(0));
+	auto expected = std::int64_t(count) * (count - 1);
+	if(sum != expected)
+	{
+		throw std::runtime_error("parallel_reduce returned a wrong sum");
+	}
+
+	std::vector<int> squares(values.size());
+	tpp::parallel_transform(pool, values.begin(), values.end(), squares.begin(), [](int v) { return v / 2 * 3; });
+	for(size_t i = 0; i < squares.size(); ++i)
+	{
+		if(squares[i] != int(i) * 3)
+		{
+			throw std::runtime_error("parallel_transform wrote a wrong value");
+		}
+	}
+
+	std::mt19937 gen(7);
+	std::shuffle(values.begin(), values.end(), gen);
+	tpp::parallel_sort(pool, values.begin(), values.end());
+	if(!std::is_sorted(values.begin(), values.end()))
+	{
+		throw std::runtime_error("parallel_sort did not sort");
+	}
+	tpp::parallel_sort(pool, values.begin(), values.end(), std::greater<>());
+	if(!std::is_sorted(values.begin(), values.end(), std::greater<>()))
+	{
+		throw std::runtime_error("parallel_sort did not sort with a comparator");
+	}
+
+	bool thrown = false;
+	try
+	{
+		tpp::parallel_for(pool, 0, count, [](int i) {
+			if(i == 42)
+			{
+				throw std::runtime_error("expected");
+			}
+		});
+	}
+	catch(const std::runtime_error&)
+	{
+		thrown = true;
+	}
+	if(!thrown)
+	{
+		throw std::runtime_error("parallel_for swallowed an exception");
+	}
+}
+
+void run_benchmarks(tpp::thread_pool& pool, int iterations)
+{
+	const size_t count = size_t(iterations) * 20000;
+	std::vector<double> data(count);
+	auto work = [](double& v) { v = std::sqrt(v + 1.0) * std::sin(v); };
+
+	auto serial = measure_ms([&]() { std::for_each(data.begin(), data.end(), work); });
+
+	auto parallel = measure_ms([&]() { tpp::parallel_for(pool, data.begin(), data.end(), work); });
+
+	// what we used to hand-roll: one scheduled job per chunk and a when_all
+	auto hand_rolled = measure_ms([&]() {
+		const size_t chunk = 1000;
+		std::vector<tpp::job_future<void>> jobs;
+		for(size_t begin = 0; begin < count; begin += chunk)
+		{
+			jobs.emplace_back(pool.schedule([&, begin]() {
+				auto end = std::min(begin + chunk, count);
+				std::for_each(data.begin() + long(begin), data.begin() + long(end), work);
+			}));
+		}
+		tpp::when_all(std::make_move_iterator(jobs.begin()), std::make_move_iterator(jobs.end())).wait();
+	});
+
+	sout() << "for_each over " << count << " elements, serial: " << serial << "ms, parallel_for: " << parallel
+		   << "ms, schedule + when_all: " << hand_rolled << "ms";
+
+	std::vector<int> values(count);
+	std::mt19937 gen(11);
+	std::generate(values.begin(), values.end(), gen);
+	auto copy = values;
+
+	auto serial_sort = measure_ms([&]() { std::sort(copy.begin(), copy.end()); });
+	auto parallel_sort = measure_ms([&]() { tpp::parallel_sort(pool, values.begin(), values.end()); });
+
+	sout() << "sort of " << count << " elements, serial: " << serial_sort << "ms, parallel_sort: " << parallel_sort
+		   << "ms";
+}
+
+void run_tests(int iterations)
+{
+	tpp::thread_pool shared_pool;
+	run_correctness_tests(shared_pool, iterations);
+	run_benchmarks(shared_pool, iterations);
+
+	tpp::thread_pool_config config;
+	config.scheduler = tpp::scheduler_type::work_stealing;
+	tpp::thread_pool stealing_pool({{tpp::priority::category::normal, tpp::thread::hardware_concurrency()}}, {}, config);
+	run_correctness_tests(stealing_pool, iterations);
+	run_benchmarks(stealing_pool, iterations);
+}
+} // namespace parallel_tests
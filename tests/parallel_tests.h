@@ -0,0 +1,6 @@
+#pragma once
+
+namespace parallel_tests
+{
+void run_tests(int iterations);
+}
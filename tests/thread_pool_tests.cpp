@@ -2,14 +2,372 @@
 #include "utils.hpp"
 
 #include <threadpp/thread_pool.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <vector>
 
 namespace thread_pool_tests
 {
 using namespace std::chrono_literals;
 
+void run_work_stealing_tests(int iterations)
+{
+	tpp::thread_pool_config config;
+	config.scheduler = tpp::scheduler_type::work_stealing;
+	tpp::thread_pool pool({{tpp::priority::category::normal, 3}, {tpp::priority::category::high, 1}}, {}, config);
+
+	// jobs spawned from inside the workers go to their own deques and get stolen
+	std::atomic<int> finished{0};
+	const int children = 10;
+	for(int i = 0; i < iterations; ++i)
+	{
+		pool.schedule(tpp::priority::normal(), [&pool, &finished]() {
+			for(int j = 0; j < children; ++j)
+			{
+				pool.schedule(tpp::priority::normal(), [&finished]() { finished++; });
+			}
+			finished++;
+		});
+	}
+
+	// stopped jobs must never run
+	std::atomic<int> stopped_runs{0};
+	auto blocker = pool.schedule(tpp::priority::high(), []() { std::this_thread::sleep_for(10ms); });
+	auto stopped = pool.schedule(tpp::priority::high(), [&stopped_runs]() { stopped_runs++; });
+	stopped.stop();
+	auto promoted = pool.schedule(tpp::priority::normal(), []() { return 42; });
+	promoted.change_priority(tpp::priority::high());
+
+	const int expected = iterations * (children + 1);
+	while(finished != expected || pool.get_jobs_count() > 0)
+	{
+		std::this_thread::yield();
+	}
+	blocker.wait();
+	if(promoted.get() != 42 || stopped_runs != 0)
+	{
+		throw std::runtime_error("work stealing pool failed to stop or reprioritize a job");
+	}
+	sout() << "work stealing pool finished " << finished << " jobs";
+}
+
+void run_large_pool_tests(int iterations)
+{
+	// each job wakes a single idle worker, busy workers drain the queue themselves
+	tpp::thread_pool pool({{tpp::priority::category::normal, 16}, {tpp::priority::category::high, 4}});
+
+	std::atomic<int> finished{0};
+	for(int i = 0; i < iterations * 10; ++i)
+	{
+		auto group = i % 2 == 0 ? tpp::priority::normal() : tpp::priority::high();
+		pool.schedule(group, [&finished]() { finished++; });
+	}
+	pool.wait_all();
+
+	sout() << "large pool finished " << finished << " jobs";
+	if(finished != iterations * 10)
+	{
+		throw std::runtime_error("large pool lost jobs");
+	}
+}
+
+void run_job_table_tests(int iterations)
+{
+	tpp::thread_pool pool({{tpp::priority::category::normal, 1}});
+
+	// a finished job's slot gets reused, its id must not reach the new job
+	std::atomic<int> finished{0};
+	for(int i = 0; i < iterations; ++i)
+	{
+		auto old_job = pool.schedule([]() {});
+		pool.wait(old_job.id);
+
+		auto new_job = pool.schedule([&finished]() { finished++; });
+		if(new_job.id == old_job.id)
+		{
+			throw std::runtime_error("job id was reused");
+		}
+		pool.stop(old_job.id);
+		pool.change_priority(old_job.id, tpp::priority::high());
+		pool.wait(new_job.id);
+	}
+
+	// waiting through the pool on a running job
+	std::atomic<bool> running{false};
+	std::atomic<bool> release{false};
+	auto running_job = pool.schedule([&]() {
+		running = true;
+		while(!release)
+		{
+			std::this_thread::yield();
+		}
+	});
+	auto pending_job = pool.schedule([&finished]() { finished++; });
+	while(!running)
+	{
+		std::this_thread::yield();
+	}
+	pool.stop_all();
+	release = true;
+	pool.wait(running_job.id);
+	if(running_job.wait_for(0ms) != std::future_status::ready)
+	{
+		throw std::runtime_error("pool wait returned before the job finished");
+	}
+	pool.wait(pending_job.id);
+
+	sout() << "job table finished " << finished << " jobs";
+	if(finished != iterations || pool.get_jobs_count() != 0)
+	{
+		throw std::runtime_error("job table lost or ran a stopped job");
+	}
+}
+
+void run_reprioritize_stress_tests()
+{
+	tpp::thread_pool pool({{tpp::priority::category::normal, 1}});
+
+	// keep the only worker busy while the jobs are shuffled around
+	std::atomic<bool> running{false};
+	std::atomic<bool> release{false};
+	auto blocker = pool.schedule([&]() {
+		running = true;
+		while(!release)
+		{
+			std::this_thread::yield();
+		}
+	});
+	while(!running)
+	{
+		std::this_thread::yield();
+	}
+
+	const size_t count = 100000;
+	std::atomic<size_t> finished{0};
+	std::vector<tpp::job_future<void>> jobs;
+	jobs.reserve(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		jobs.emplace_back(pool.schedule(tpp::priority::normal(i % 8), [&finished]() { finished++; }));
+	}
+
+	auto start = tpp::clock::now();
+	for(size_t i = 0; i < count; ++i)
+	{
+		auto priority = (i * 7919) % 64;
+		jobs[i].change_priority(i % 3 == 0 ? tpp::priority::high(priority) : tpp::priority::normal(priority));
+	}
+	auto reprioritized = tpp::clock::now();
+
+	// a stopped job leaves its queue right away
+	size_t stopped = 0;
+	for(size_t i = 0; i < count; i += 10)
+	{
+		jobs[i].stop();
+		stopped++;
+	}
+
+	release = true;
+	pool.wait_all();
+
+	auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(reprioritized - start);
+	sout() << "reprioritized " << count << " jobs in " << dur.count() << "ms";
+	if(finished != count - stopped || pool.get_jobs_count() != 0)
+	{
+		throw std::runtime_error("reprioritized jobs were lost or run twice");
+	}
+}
+
+// runs the scheduled jobs on a single worker once they are all queued
+// and returns the order in which they ran
+std::vector<int> run_in_order(tpp::thread_pool_config config,
+							  const std::function<void(tpp::thread_pool&, std::vector<int>&)>& schedule)
+{
+	tpp::thread_pool pool({{tpp::priority::category::normal, 1}}, {}, config);
+
+	std::atomic<bool> running{false};
+	std::atomic<bool> release{false};
+	pool.schedule([&]() {
+		running = true;
+		while(!release)
+		{
+			std::this_thread::yield();
+		}
+	});
+	while(!running)
+	{
+		std::this_thread::yield();
+	}
+
+	std::vector<int> order;
+	schedule(pool, order);
+	release = true;
+	pool.wait_all();
+	return order;
+}
+
+void run_scheduling_policy_tests()
+{
+	const int count = 40;
+
+	// jobs of equal priority run in the order they were scheduled
+	auto order = run_in_order({}, [&](tpp::thread_pool& pool, std::vector<int>& order) {
+		for(int i = 0; i < count; ++i)
+		{
+			pool.schedule(tpp::priority::normal(size_t(i % 2)), [&order, i]() { order.push_back(i); });
+		}
+	});
+	std::vector<int> expected;
+	for(int i = 1; i < count; i += 2)
+	{
+		expected.push_back(i);
+	}
+	for(int i = 0; i < count; i += 2)
+	{
+		expected.push_back(i);
+	}
+	if(order != expected)
+	{
+		throw std::runtime_error("jobs of equal priority did not run in order");
+	}
+
+	// normal jobs get their share next to the critical ones
+	tpp::thread_pool_config fair;
+	fair.policy = tpp::scheduling_policy::weighted_fair;
+	fair.weights = {{1, 1, 4}};
+	order = run_in_order(fair, [&](tpp::thread_pool& pool, std::vector<int>& order) {
+		for(int i = 0; i < count; ++i)
+		{
+			pool.schedule(tpp::priority::critical(), [&order]() { order.push_back(1); });
+			pool.schedule(tpp::priority::normal(), [&order]() { order.push_back(0); });
+		}
+	});
+	// about one in five, the blocking job already took a normal turn
+	auto normal_in_first_twenty = std::count(order.begin(), order.begin() + 20, 0);
+	sout() << "weighted fair ran " << normal_in_first_twenty << " normal jobs of the first 20";
+	if(normal_in_first_twenty < 2 || normal_in_first_twenty > 5)
+	{
+		throw std::runtime_error("weighted fair scheduling did not share by weight");
+	}
+
+	// normal jobs which waited long enough run before newer critical ones
+	tpp::thread_pool_config aging;
+	aging.policy = tpp::scheduling_policy::aging;
+	aging.aging_interval = 1ms;
+	order = run_in_order(aging, [&](tpp::thread_pool& pool, std::vector<int>& order) {
+		for(int i = 0; i < count; ++i)
+		{
+			pool.schedule(tpp::priority::normal(), [&order]() { order.push_back(0); });
+		}
+		std::this_thread::sleep_for(5ms);
+		for(int i = 0; i < count; ++i)
+		{
+			pool.schedule(tpp::priority::critical(), [&order]() { order.push_back(1); });
+		}
+	});
+	if(std::count(order.begin(), order.begin() + count, 0) != count)
+	{
+		throw std::runtime_error("aged jobs were starved by newer ones");
+	}
+
+	// the largest priority still ranks above a small one
+	for(const auto& config : {tpp::thread_pool_config{}, aging})
+	{
+		order = run_in_order(config, [&](tpp::thread_pool& pool, std::vector<int>& order) {
+			pool.schedule(tpp::priority::normal(1), [&order]() { order.push_back(0); });
+			pool.schedule(tpp::priority::normal(size_t(-1)), [&order]() { order.push_back(1); });
+		});
+		if(order != std::vector<int>{1, 0})
+		{
+			throw std::runtime_error("the largest priority did not run first");
+		}
+	}
+}
+
+void run_elastic_tests()
+{
+	tpp::thread_pool_config config;
+	config.elastic[tpp::priority::category::normal] = {1, 4};
+	config.spawn_delay = 5ms;
+	config.idle_timeout = 50ms;
+	tpp::thread_pool pool({{tpp::priority::category::normal, 1}}, {}, config);
+
+	// jobs blocking like they would on io keep the queue deep
+	std::vector<tpp::job_future<void>> jobs;
+	for(int i = 0; i < 40; ++i)
+	{
+		jobs.emplace_back(pool.schedule([]() { std::this_thread::sleep_for(5ms); }));
+	}
+	pool.wait_all();
+
+	auto spawned = pool.get_spawned_workers_count();
+	sout() << "elastic pool spawned " << spawned << " workers";
+	if(spawned == 0 || pool.get_workers_count() > 4)
+	{
+		throw std::runtime_error("elastic pool did not grow within its bounds");
+	}
+
+	auto deadline = tpp::clock::now() + 5s;
+	while(pool.get_workers_count(tpp::priority::category::normal) > 1 && tpp::clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(10ms);
+	}
+	if(pool.get_workers_count() != 1 || pool.get_retired_workers_count() != spawned)
+	{
+		throw std::runtime_error("elastic pool did not shrink to its minimum");
+	}
+
+	// an elastic category without workers spawns one for its first job
+	config.elastic[tpp::priority::category::normal] = {0, 2};
+	config.spawn_delay = 1s;
+	tpp::thread_pool empty_pool({}, {}, config);
+	auto job = empty_pool.schedule([]() {});
+	if(job.wait_for(500ms) != std::future_status::ready)
+	{
+		throw std::runtime_error("elastic pool did not spawn a worker for a job nobody could run");
+	}
+}
+
+void run_nested_wait_tests()
+{
+	for(auto scheduler : {tpp::scheduler_type::shared_queue, tpp::scheduler_type::work_stealing})
+	{
+		tpp::thread_pool_config config;
+		config.scheduler = scheduler;
+		// a single worker would deadlock if waiting blocked it
+		tpp::thread_pool pool({{tpp::priority::category::normal, 1}}, {}, config);
+
+		std::function<int(int)> fib = [&](int n) {
+			if(n < 2)
+			{
+				return n;
+			}
+			auto left = pool.schedule([&fib, n]() { return fib(n - 1); });
+			auto right = fib(n - 2);
+			return left.get() + right;
+		};
+
+		auto result = pool.schedule([&fib]() { return fib(15); });
+		if(result.wait_for(10s) != std::future_status::ready || result.get() != 610)
+		{
+			throw std::runtime_error("nested jobs did not complete while waiting on each other");
+		}
+	}
+}
+
 void run_tests(int iterations)
 {
+	run_work_stealing_tests(iterations);
+	run_large_pool_tests(iterations);
+	run_job_table_tests(iterations);
+	run_reprioritize_stress_tests();
+	run_scheduling_policy_tests();
+	run_elastic_tests();
+	run_nested_wait_tests();
+
 	auto now = tpp::clock::now();
 
 	tpp::thread_pool pool({{tpp::priority::category::normal, 2},
@@ -62,6 +420,21 @@ void run_tests(int iterations)
 		}
 	}
 
+	std::vector<std::function<int()>> batch;
+	for(int i = 0; i < iterations; ++i)
+	{
+		batch.emplace_back([i]() { return i; });
+	}
+	auto batch_futures = pool.schedule_bulk(tpp::priority::high(), batch.begin(), batch.end());
+	for(int i = 0; i < iterations; ++i)
+	{
+		if(batch_futures[size_t(i)].get() != i)
+		{
+			throw std::runtime_error("bulk scheduled job returned a wrong value");
+		}
+	}
+	sout() << "bulk scheduled " << batch_futures.size() << " jobs";
+
 	// pool.stop_all();
 	pool.wait_all();
 
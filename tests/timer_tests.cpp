@@ -0,0 +1,172 @@
+#include "timer_tests.h"
+#include "utils.hpp"
+
+#include <threadpp/thread.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace timer_tests
+{
+
+void wait_idle(tpp::thread::id id)
+{
+	while(tpp::get_pending_task_count(id) > 0)
+	{
+		std::this_thread::yield();
+	}
+}
+
+void run_order_test()
+{
+	auto th = tpp::make_thread();
+	auto start = tpp::clock::now();
+
+	// only touched by the timer thread until it is idle again
+	std::vector<int> order;
+	std::vector<tpp::clock::duration> late;
+	auto schedule = [&](int delay_ms)
+	{
+		auto delay = std::chrono::milliseconds(delay_ms);
+		tpp::invoke_after(th.get_id(), delay, [&order, &late, start, delay, delay_ms]() {
+			order.push_back(delay_ms);
+			late.push_back(tpp::clock::now() - (start + delay));
+		});
+	};
+	schedule(30);
+	schedule(10);
+	schedule(20);
+
+	std::atomic<bool> done{false};
+	tpp::invoke_at(th.get_handle(), start + std::chrono::milliseconds(40), [&done]() { done = true; });
+	while(!done)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	sout() << "timers ran in order " << order[0] << " " << order[1] << " " << order[2];
+	if(order != std::vector<int>{10, 20, 30})
+	{
+		throw std::runtime_error("timers ran out of order");
+	}
+	for(const auto& lateness : late)
+	{
+		if(lateness < lateness.zero() || lateness > std::chrono::milliseconds(500))
+		{
+			throw std::runtime_error("timer did not run at its deadline");
+		}
+	}
+}
+
+void run_cancel_test(int iterations)
+{
+	auto th = tpp::make_thread();
+	std::atomic<int> ran{0};
+	int cancelled = 0;
+
+	std::mt19937 random(42);
+	std::uniform_int_distribution<int> delays(0, 20);
+
+	const int count = iterations * 1000;
+	std::vector<tpp::timer_handle> handles;
+	handles.reserve(size_t(count));
+	for(int i = 0; i < count; ++i)
+	{
+		handles.emplace_back(tpp::invoke_after(th.get_id(), std::chrono::milliseconds(delays(random)), [&ran]() { ran++; }));
+	}
+	for(size_t i = 0; i < handles.size(); i += 2)
+	{
+		if(handles[i].cancel())
+		{
+			cancelled++;
+		}
+	}
+
+	// a cancelled timer never runs, the rest do
+	for(auto& handle : handles)
+	{
+		while(!handle.expired())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	wait_idle(th.get_id());
+
+	sout() << "timers ran " << ran << ", cancelled " << cancelled << " of " << count;
+	if(ran + cancelled != count || cancelled == 0 || handles[0].cancel())
+	{
+		throw std::runtime_error("timer cancellation lost or ran timers");
+	}
+}
+
+void run_periodic_test()
+{
+	auto th = tpp::make_thread();
+	auto runs = std::make_shared<std::atomic<int>>(0);
+
+	auto handle = tpp::invoke_every(th.get_id(), std::chrono::milliseconds(2), [runs]() { (*runs)++; });
+	while(*runs < 5)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if(!handle.cancel() || !handle.expired())
+	{
+		throw std::runtime_error("periodic timer could not be cancelled");
+	}
+
+	// a run which already started may still finish
+	tpp::invoke(th.get_id(), []() {});
+	wait_idle(th.get_id());
+	auto after_cancel = runs->load();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+	sout() << "periodic timer ran " << after_cancel << " times";
+	if(*runs != after_cancel)
+	{
+		throw std::runtime_error("periodic timer ran after being cancelled");
+	}
+
+	// a period which is not positive is rejected rather than run once
+	auto zero_runs = std::make_shared<std::atomic<int>>(0);
+	auto zero = tpp::invoke_every(th.get_id(), std::chrono::milliseconds(0), [zero_runs]() { (*zero_runs)++; });
+	auto negative = tpp::invoke_every(th.get_handle(), std::chrono::milliseconds(-1), [zero_runs]() { (*zero_runs)++; });
+	tpp::invoke(th.get_id(), []() {});
+	wait_idle(th.get_id());
+	if(!zero.expired() || !negative.expired() || zero.cancel() || *zero_runs != 0)
+	{
+		throw std::runtime_error("periodic timer accepted a period which is not positive");
+	}
+}
+
+void run_expired_thread_test()
+{
+	tpp::timer_handle handle;
+	auto callable = std::make_shared<int>(0);
+	{
+		auto th = tpp::make_thread();
+		handle = tpp::invoke_after(th.get_handle(), std::chrono::hours(1), [callable]() {});
+		if(handle.expired())
+		{
+			throw std::runtime_error("timer expired before its deadline");
+		}
+	}
+
+	// the thread took the timer down with it
+	if(!handle.expired() || handle.cancel() || callable.use_count() != 1)
+	{
+		throw std::runtime_error("timer outlived its thread");
+	}
+}
+
+void run_tests(int iterations)
+{
+	run_order_test();
+	run_cancel_test(iterations);
+	run_periodic_test();
+	run_expired_thread_test();
+}
+} // namespace timer_tests
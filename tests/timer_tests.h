@@ -0,0 +1,6 @@
+#pragma once
+
+namespace timer_tests
+{
+void run_tests(int iterations);
+}
@@ -2,6 +2,8 @@
 #include "utils.hpp"
 
 #include <chrono>
+#include <stdexcept>
+#include <vector>
 #include <threadpp/thread_pool.h>
 #include <threadpp/when_all_any.hpp>
 
@@ -9,8 +11,129 @@ namespace when_tests
 {
 using namespace std::chrono_literals;
 
+void run_when_all_range_tests(int count)
+{
+	auto worker = tpp::make_thread();
+	auto worker_id = worker.get_id();
+
+	{
+		std::vector<tpp::future<int>> futures;
+		futures.reserve(static_cast<size_t>(count));
+		for(int i = 0; i < count; ++i)
+		{
+			futures.emplace_back(tpp::async(worker_id, [i]() { return i; }));
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		auto all = tpp::when_all(futures.begin(), futures.end()).get();
+		auto end = std::chrono::steady_clock::now();
+
+		if(all.size() != static_cast<size_t>(count))
+		{
+			throw std::runtime_error("when_all lost some futures");
+		}
+		for(int i = 0; i < count; ++i)
+		{
+			if(all[static_cast<size_t>(i)].get() != i)
+			{
+				throw std::runtime_error("when_all returned futures out of order");
+			}
+		}
+		sout() << "when_all of " << count << " futures took "
+			   << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "us\n";
+	}
+
+	{
+		std::vector<tpp::shared_future<int>> futures;
+		for(int i = 0; i < count; ++i)
+		{
+			futures.emplace_back(tpp::async(worker_id, [i]() { return i * 2; }).share());
+		}
+
+		auto values = tpp::when_all_values(futures.begin(), futures.end()).get();
+		for(int i = 0; i < count; ++i)
+		{
+			if(values[static_cast<size_t>(i)] != i * 2)
+			{
+				throw std::runtime_error("when_all_values returned a wrong value");
+			}
+		}
+		// the inputs are copied, not consumed
+		if(!futures.front().valid())
+		{
+			throw std::runtime_error("when_all_values consumed a shared_future");
+		}
+	}
+
+	{
+		std::vector<tpp::future<int>> futures;
+		futures.emplace_back(tpp::make_ready_future(1));
+		futures.emplace_back(tpp::async(worker_id, []() -> int { throw std::runtime_error("propagate"); }));
+		futures.emplace_back(tpp::async(worker_id, []() { return 3; }));
+
+		auto values = tpp::when_all_values(futures.begin(), futures.end());
+		try
+		{
+			values.get();
+			throw std::logic_error("when_all_values did not propagate the exception");
+		}
+		catch(const std::runtime_error&)
+		{
+		}
+	}
+
+	{
+		std::vector<tpp::future<int>> empty;
+		if(!tpp::when_all_values(empty.begin(), empty.end()).get().empty())
+		{
+			throw std::runtime_error("when_all_values of nothing is not empty");
+		}
+	}
+}
+
+void run_when_any_tests(int count)
+{
+	auto worker = tpp::make_thread();
+	auto worker_id = worker.get_id();
+
+	tpp::promise<int> never;
+	auto loser = never.get_future().share();
+	// held by the promise and by loser
+	auto baseline_use_count = loser._internal_get_state().use_count();
+
+	// select style loop, the losers must not keep anything attached
+	for(int i = 0; i < count; ++i)
+	{
+		auto winner = tpp::async(worker_id, [i]() { return i; }).share();
+
+		auto any = tpp::when_any(loser, winner).get();
+		if(any.index != 1 || std::get<1>(any.futures).get() != i)
+		{
+			throw std::runtime_error("when_any picked the wrong future");
+		}
+
+		std::vector<tpp::shared_future<int>> futures{loser, winner};
+		auto any_range = tpp::when_any(futures.begin(), futures.end()).get();
+		if(any_range.index != 1 || any_range.futures[1].get() != i)
+		{
+			throw std::runtime_error("when_any picked the wrong future");
+		}
+	}
+
+	// the winning continuation is released on the worker after it ran
+	tpp::async(worker_id, []() {}).wait();
+	if(loser._internal_get_state().use_count() != baseline_use_count)
+	{
+		throw std::runtime_error("when_any left its context attached to the losers");
+	}
+	never.set_value(0);
+}
+
 void run_tests(int iterations)
 {
+	run_when_all_range_tests(iterations * 200);
+	run_when_any_tests(iterations * 20);
+
 	auto thread1 = tpp::make_thread();
 	auto thread2 = tpp::make_thread();
 
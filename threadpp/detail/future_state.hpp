@@ -1,7 +1,20 @@
 #pragma once
-#include "../condition_variable.hpp"
+#include "../thread.h"
+#include "parking_lot.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <future>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 #include <vector>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 namespace tpp
 {
 
@@ -11,18 +24,69 @@ namespace detail
 enum class value_status : unsigned
 {
     not_set,
+    // claimed by a setter which is still constructing the value
+    setting,
     ready,
     error
 };
 
+//-----------------------------------------------------------------------------
+/// Node of the intrusive continuation stack.
+//-----------------------------------------------------------------------------
+struct continuation_node
+{
+    task callable;
+    continuation_node* next{};
+    // set once by whoever gets to the callable first,
+    // the setter running it or a cancellation
+    std::atomic<bool> claimed{false};
+    // held by the stack and by the owner of a cancellable continuation
+    std::atomic<std::uint32_t> refs{1};
+};
+
+inline void cpu_relax() noexcept
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+//-----------------------------------------------------------------------------
+/// Shared state of a future. Setting the result and attaching continuations
+/// are lock free: the status is claimed with a CAS and continuations are
+/// pushed onto a lock free stack which the setter closes and runs.
+/// The mutex is only taken when some thread is blocked in wait().
+/// Waiters spin briefly before blocking. Registered threads then keep
+/// processing their tasks, or run the work of their wait helper, and are
+/// unparked by the setter. The others block in the parking lot.
+//-----------------------------------------------------------------------------
 template<typename T>
 struct basic_state
 {
-    using callback_container = std::vector<task>;
+    basic_state() = default;
+    basic_state(const basic_state&) = delete;
+    auto operator=(const basic_state&) -> basic_state& = delete;
+
+    ~basic_state()
+    {
+        auto node = continuations.load(std::memory_order_acquire);
+        while(node != nullptr && node != closed_marker())
+        {
+            auto next = node->next;
+            release_ref(node);
+            node = next;
+        }
+    }
 
-    condition_variable cv;
+    // registered threads blocked in wait
     mutable std::mutex guard;
-    callback_container callbacks;
+    mutable std::vector<thread::id> waiting_threads;
+    mutable std::atomic<std::uint32_t> waiters{0};
+
+    std::atomic<continuation_node*> continuations{nullptr};
+    // the first continuation does not allocate
+    continuation_node first_continuation;
+    std::atomic_flag first_continuation_taken = ATOMIC_FLAG_INIT;
 
     std::exception_ptr exception;
 
@@ -31,7 +95,8 @@ struct basic_state
 
     bool ready() const
     {
-        return status != value_status::not_set;
+        auto s = status.load();
+        return s == value_status::ready || s == value_status::error;
     }
 
     bool has_error() const
@@ -41,29 +106,60 @@ struct basic_state
 
     void set_exception(std::exception_ptr ex)
     {
-        std::unique_lock<std::mutex> lock(guard);
+        claim();
+        exception = std::move(ex);
+        set_ready(value_status::error);
+    }
 
-        if(ready())
+    void claim()
+    {
+        auto expected = value_status::not_set;
+        if(!status.compare_exchange_strong(expected, value_status::setting))
         {
             throw std::future_error(std::future_errc::promise_already_satisfied);
         }
-        exception = std::move(ex);
-        set_ready(lock, value_status::error);
     }
 
-    void set_ready(std::unique_lock<std::mutex>& lock, value_status s)
+    void unclaim()
     {
-        callback_container continuations;
+        status = value_status::not_set;
+    }
+
+    void set_ready(value_status s)
+    {
+        status = s;
+
+        // pairs with the increment in wait, either the waiter
+        // sees the status or we see the waiter
+        if(waiters.load() != 0)
         {
-            status = s;
-            continuations = std::move(callbacks);
-            callbacks.clear();
-            cv.notify_all();
+            wake_waiters();
         }
 
-        lock.unlock();
-        for(const auto& continuation : continuations)
+        // close the stack so that late continuations run directly
+        auto node = continuations.exchange(closed_marker(), std::memory_order_acq_rel);
+
+        // reverse to run them in the order they were attached
+        continuation_node* ordered = nullptr;
+        while(node != nullptr)
         {
+            auto next = node->next;
+            node->next = ordered;
+            ordered = node;
+            node = next;
+        }
+
+        while(ordered != nullptr)
+        {
+            auto next = ordered->next;
+            task continuation;
+            if(!ordered->claimed.exchange(true, std::memory_order_acq_rel))
+            {
+                continuation = std::move(ordered->callable);
+            }
+            release_ref(ordered);
+            ordered = next;
+
             if(continuation)
             {
                 continuation();
@@ -73,121 +169,341 @@ struct basic_state
 
     void set_continuation(task continuation)
     {
-        {
-            std::lock_guard<std::mutex> lock(guard);
-            if(!ready())
-            {
-                callbacks.emplace_back(std::move(continuation));
-                return;
-            }
-        }
+        push_continuation(continuation, 1);
+    }
 
-        if(continuation)
+    //-----------------------------------------------------------------------------
+    /// Like set_continuation but returns a node which can be passed to
+    /// cancel_continuation or nullptr if the continuation already ran.
+    /// Every returned node must be passed to cancel_continuation exactly
+    /// once while the state is alive, even if the continuation has run.
+    //-----------------------------------------------------------------------------
+    auto set_cancellable_continuation(task continuation) -> continuation_node*
+    {
+        return push_continuation(continuation, 2);
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Detaches the continuation unless it already started running.
+    /// Its callable is destroyed right away, the node itself is released
+    /// by the state.
+    //-----------------------------------------------------------------------------
+    void cancel_continuation(continuation_node* node) noexcept
+    {
+        if(!node->claimed.exchange(true, std::memory_order_acq_rel))
         {
-            continuation();
+            node->callable = nullptr;
         }
+        release_ref(node);
     }
 
-    void wait()
+    void wait() const
     {
-        std::unique_lock<std::mutex> lock(guard);
-        while(!ready())
+        if(spin_until_ready())
         {
-            if(this_thread::notified_for_exit())
+            return;
+        }
+
+        waiters++;
+        if(this_thread::is_registered())
+        {
+            add_waiting_thread();
+            // only untimed waits help, the work could overrun a timeout
+            auto helper = get_wait_helper();
+            while(!ready())
+            {
+                if(this_thread::notified_for_exit())
+                {
+                    // not ready, see check_value_ready
+                    break;
+                }
+                if(helper != nullptr && helper->help())
+                {
+                    continue;
+                }
+                this_thread::wait();
+            }
+            if(helper != nullptr)
             {
-                break;
+                helper->stop_helping();
             }
-            cv.wait(lock);
+            remove_waiting_thread();
         }
+        else
+        {
+            parking_lot::park(this,
+                              [this]()
+                              {
+                                  return ready();
+                              });
+        }
+        waiters--;
     }
 
     template<typename Rep, typename Per>
     auto wait_for(const std::chrono::duration<Rep, Per>& timeout_duration) const -> std::future_status
     {
-        std::unique_lock<std::mutex> lock(guard);
+        if(spin_until_ready())
+        {
+            return std::future_status::ready;
+        }
+
+        auto result = std::future_status::ready;
+        auto end_time = std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout_duration);
 
-        while(!ready())
+        waiters++;
+        if(this_thread::is_registered())
         {
-            if(this_thread::notified_for_exit())
+            add_waiting_thread();
+            while(!ready())
             {
-                return std::future_status::deferred;
+                if(this_thread::notified_for_exit())
+                {
+                    result = std::future_status::deferred;
+                    break;
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                if(now >= end_time)
+                {
+                    result = std::future_status::timeout;
+                    break;
+                }
+                this_thread::wait_for(end_time - now);
             }
-
-            if(cv.wait_for(lock, timeout_duration) == std::cv_status::timeout)
+            remove_waiting_thread();
+        }
+        else
+        {
+            auto is_ready = parking_lot::park_until(this,
+                                                    end_time,
+                                                    [this]()
+                                                    {
+                                                        return ready();
+                                                    });
+            if(!is_ready)
             {
-                return std::future_status::timeout;
+                result = std::future_status::timeout;
             }
         }
+        waiters--;
 
-        return std::future_status::ready;
+        return result;
     }
 
-    void rethrow_any_exception() const
+    //-----------------------------------------------------------------------------
+    /// Throws unless the result is a value. A wait cut short by an exit
+    /// notification returns before the result is ready, while the value
+    /// or the exception may still be written, so neither is read then.
+    //-----------------------------------------------------------------------------
+    void check_value_ready() const
     {
+        auto s = status.load(std::memory_order_acquire);
+        if(s == value_status::ready)
+        {
+            return;
+        }
+        if(s != value_status::error)
+        {
+            throw std::runtime_error("the result is not ready");
+        }
+
         if(exception)
         {
             std::rethrow_exception(exception);
         }
+        throw std::future_error(std::future_errc::broken_promise);
     }
-};
 
-template<typename T>
-struct future_state : public basic_state<T>
-{
-    std::shared_ptr<T> value;
+private:
+    //-----------------------------------------------------------------------------
+    /// A result which arrives within a few microseconds is picked up
+    /// without paying for a park and a wake up.
+    //-----------------------------------------------------------------------------
+    auto spin_until_ready() const -> bool
+    {
+        const int spin_count = 128;
+        const int yield_count = 16;
+        for(int i = 0; i < spin_count; ++i)
+        {
+            if(ready())
+            {
+                return true;
+            }
+            cpu_relax();
+        }
+        for(int i = 0; i < yield_count; ++i)
+        {
+            if(ready())
+            {
+                return true;
+            }
+            std::this_thread::yield();
+        }
+        return ready();
+    }
 
-    template<typename V>
-    void set_value(V&& val)
+    void add_waiting_thread() const
     {
-        std::unique_lock<std::mutex> lock(this->guard);
+        std::lock_guard<std::mutex> lock(guard);
+        waiting_threads.emplace_back(this_thread::get_id());
+    }
 
-        if(this->ready())
+    void remove_waiting_thread() const
+    {
+        std::lock_guard<std::mutex> lock(guard);
+        auto it = std::find(waiting_threads.begin(), waiting_threads.end(), this_thread::get_id());
+        if(it != waiting_threads.end())
         {
-            throw std::future_error(std::future_errc::promise_already_satisfied);
+            waiting_threads.erase(it);
+        }
+    }
+
+    void wake_waiters()
+    {
+        std::vector<thread::id> threads;
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            threads.swap(waiting_threads);
+        }
+        for(auto id : threads)
+        {
+            unpark(id);
         }
 
-        this->value = std::make_shared<std::decay_t<V>>(std::forward<V>(val));
-        this->set_ready(lock, value_status::ready);
+        parking_lot::unpark_all(this);
     }
 
-    auto get_value_assuming_ready() -> decltype(auto)
+    auto push_continuation(task& continuation, std::uint32_t refs) -> continuation_node*
     {
-        std::unique_lock<std::mutex> lock(this->guard);
+        auto head = continuations.load(std::memory_order_acquire);
+        if(head != closed_marker())
+        {
+            auto node = acquire_node();
+            node->callable = std::move(continuation);
+            node->refs.store(refs, std::memory_order_relaxed);
 
-        if(value)
+            do
+            {
+                if(head == closed_marker())
+                {
+                    continuation = std::move(node->callable);
+                    release_node(node);
+                    break;
+                }
+                node->next = head;
+            } while(!continuations.compare_exchange_weak(
+                head, node, std::memory_order_acq_rel, std::memory_order_acquire));
+
+            if(head != closed_marker())
+            {
+                return node;
+            }
+        }
+
+        if(continuation)
         {
-            return *value;
+            continuation();
         }
+        return nullptr;
+    }
 
-        if(this->exception)
+    void release_ref(continuation_node* node) noexcept
+    {
+        if(node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
         {
-            std::rethrow_exception(this->exception);
+            release_node(node);
         }
-        else
+    }
+
+    static auto closed_marker() noexcept -> continuation_node*
+    {
+        static continuation_node closed;
+        return &closed;
+    }
+
+    auto acquire_node() -> continuation_node*
+    {
+        if(!first_continuation_taken.test_and_set(std::memory_order_relaxed))
         {
-            throw std::future_error(std::future_errc::broken_promise);
+            return &first_continuation;
         }
+        return new continuation_node();
+    }
+
+    void release_node(continuation_node* node) noexcept
+    {
+        if(node == &first_continuation)
+        {
+            node->callable = nullptr;
+            return;
+        }
+        delete node;
     }
 };
 
-template<>
-struct future_state<void> : public basic_state<void>
+template<typename T>
+struct future_state : public basic_state<T>
 {
-    void set_value()
+    future_state() = default;
+    future_state(const future_state&) = delete;
+    auto operator=(const future_state&) -> future_state& = delete;
+
+    ~future_state()
     {
-        std::unique_lock<std::mutex> lock(guard);
+        if(this->status == value_status::ready)
+        {
+            get_value().~T();
+        }
+    }
 
-        if(ready())
+    template<typename V>
+    void set_value(V&& val)
+    {
+        this->claim();
+        try
         {
-            throw std::future_error(std::future_errc::promise_already_satisfied);
+            ::new(&storage) T(std::forward<V>(val));
+        }
+        catch(...)
+        {
+            this->unclaim();
+            throw;
         }
+        this->set_ready(value_status::ready);
+    }
 
-        set_ready(lock, value_status::ready);
+    auto get_value_assuming_ready() -> T&
+    {
+        // the value is constructed before the status is published
+        this->check_value_ready();
+        return get_value();
+    }
+
+private:
+    auto get_value() noexcept -> T&
+    {
+        return *reinterpret_cast<T*>(&storage);
+    }
+
+    // the value lives inside the state so that
+    // a result costs a single allocation
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+};
+
+template<>
+struct future_state<void> : public basic_state<void>
+{
+    void set_value()
+    {
+        claim();
+        set_ready(value_status::ready);
     }
 
     void get_value_assuming_ready()
     {
-        rethrow_any_exception();
+        check_value_ready();
     }
 };
 template<typename T>
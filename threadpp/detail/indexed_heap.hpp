@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace tpp
+{
+namespace detail
+{
+
+//-----------------------------------------------------------------------------
+/// Addressable d-ary heap with the greatest element on top.
+/// Every element is told its position through on_move(element, index)
+/// whenever it changes and npos once it leaves the heap, so elements can
+/// be reprioritized or removed in O(log n) instead of being left behind.
+/// A wider node makes the tree shallower, so pushes and raised priorities
+/// sift up through fewer levels. Sifting down compares more children per
+/// level, but they sit next to each other in memory.
+//-----------------------------------------------------------------------------
+template<typename T, typename Compare, typename OnMove, std::size_t Arity = 4>
+class indexed_heap
+{
+    static_assert(Arity >= 2, "a heap node needs at least two children");
+
+public:
+    static constexpr std::size_t npos = std::size_t(-1);
+
+    explicit indexed_heap(Compare compare = {}, OnMove on_move = {})
+        : compare_(std::move(compare))
+        , on_move_(std::move(on_move))
+    {
+    }
+
+    void push(T value)
+    {
+        elements_.emplace_back(std::move(value));
+        sift_up(elements_.size() - 1);
+    }
+
+    auto top() const -> const T&
+    {
+        return elements_.front();
+    }
+
+    auto pop() -> T
+    {
+        return erase(0);
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Restores the order after the key of the element at index changed.
+    //-----------------------------------------------------------------------------
+    void update(std::size_t index)
+    {
+        if(index > 0 && compare_(elements_[parent(index)], elements_[index]))
+        {
+            sift_up(index);
+        }
+        else
+        {
+            sift_down(index);
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Removes and returns the element at index.
+    //-----------------------------------------------------------------------------
+    auto erase(std::size_t index) -> T
+    {
+        T result = std::move(elements_[index]);
+
+        // the last element fills the hole
+        auto last = elements_.size() - 1;
+        if(index != last)
+        {
+            elements_[index] = std::move(elements_[last]);
+            elements_.pop_back();
+            update(index);
+        }
+        else
+        {
+            elements_.pop_back();
+        }
+
+        on_move_(result, npos);
+        return result;
+    }
+
+    void clear()
+    {
+        for(auto& element : elements_)
+        {
+            on_move_(element, npos);
+        }
+        elements_.clear();
+    }
+
+    auto size() const noexcept -> std::size_t
+    {
+        return elements_.size();
+    }
+
+    auto empty() const noexcept -> bool
+    {
+        return elements_.empty();
+    }
+
+private:
+    static auto parent(std::size_t index) noexcept -> std::size_t
+    {
+        return (index - 1) / Arity;
+    }
+
+    void place(std::size_t index, T value)
+    {
+        elements_[index] = std::move(value);
+        on_move_(elements_[index], index);
+    }
+
+    // the moved element is carried along and only placed once
+    void sift_up(std::size_t index)
+    {
+        T value = std::move(elements_[index]);
+        while(index > 0)
+        {
+            auto up = parent(index);
+            if(!compare_(elements_[up], value))
+            {
+                break;
+            }
+            place(index, std::move(elements_[up]));
+            index = up;
+        }
+        place(index, std::move(value));
+    }
+
+    void sift_down(std::size_t index)
+    {
+        T value = std::move(elements_[index]);
+        auto count = elements_.size();
+        while(true)
+        {
+            auto first = index * Arity + 1;
+            if(first >= count)
+            {
+                break;
+            }
+
+            auto best = first;
+            auto last = std::min(first + Arity, count);
+            for(auto child = first + 1; child < last; ++child)
+            {
+                if(compare_(elements_[best], elements_[child]))
+                {
+                    best = child;
+                }
+            }
+
+            if(!compare_(value, elements_[best]))
+            {
+                break;
+            }
+            place(index, std::move(elements_[best]));
+            index = best;
+        }
+        place(index, std::move(value));
+    }
+
+    std::vector<T> elements_;
+    Compare compare_;
+    OnMove on_move_;
+};
+
+} // namespace detail
+} // namespace tpp
@@ -0,0 +1,38 @@
+#include "parking_lot.h"
+#include <array>
+#include <cstdint>
+
+namespace tpp
+{
+namespace detail
+{
+
+namespace
+{
+constexpr std::size_t buckets_count = 64;
+}
+
+void parking_lot::unpark_all(const void* address)
+{
+    auto& bucket = get_bucket(address);
+
+    // a waiter holds the mutex from its last check until it waits,
+    // so once we get it the notification can no longer be missed
+    {
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+    }
+    bucket.event.notify_all();
+}
+
+auto parking_lot::get_bucket(const void* address) -> bucket&
+{
+    static std::array<bucket, buckets_count> buckets;
+
+    // drop the low bits which are the same for all aligned objects
+    auto key = reinterpret_cast<std::uintptr_t>(address);
+    key ^= key >> 12;
+    return buckets[(key >> 4) % buckets_count];
+}
+
+} // namespace detail
+} // namespace tpp
@@ -0,0 +1,63 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace tpp
+{
+namespace detail
+{
+
+//-----------------------------------------------------------------------------
+/// Lets threads which are not registered block on an address until it is
+/// unparked. Addresses are hashed onto a fixed set of buckets so waiting
+/// never allocates. Unrelated addresses may share a bucket, so waiters
+/// must always re-check their condition.
+//-----------------------------------------------------------------------------
+class parking_lot
+{
+public:
+    //-----------------------------------------------------------------------------
+    /// Blocks until ready() returns true. ready() is checked under the
+    /// bucket's mutex, so an unpark_all after the condition became true
+    /// cannot be missed.
+    //-----------------------------------------------------------------------------
+    template<typename Predicate>
+    static void park(const void* address, Predicate ready)
+    {
+        auto& bucket = get_bucket(address);
+        std::unique_lock<std::mutex> lock(bucket.mutex);
+        bucket.event.wait(lock, ready);
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Blocks until ready() returns true or abs_time is reached.
+    /// Returns the last result of ready().
+    //-----------------------------------------------------------------------------
+    template<typename Predicate>
+    static auto park_until(const void* address,
+                           const std::chrono::steady_clock::time_point& abs_time,
+                           Predicate ready) -> bool
+    {
+        auto& bucket = get_bucket(address);
+        std::unique_lock<std::mutex> lock(bucket.mutex);
+        return bucket.event.wait_until(lock, abs_time, ready);
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Wakes all threads parked on address (and those sharing its bucket).
+    //-----------------------------------------------------------------------------
+    static void unpark_all(const void* address);
+
+private:
+    struct bucket
+    {
+        std::mutex mutex;
+        std::condition_variable event;
+    };
+
+    static auto get_bucket(const void* address) -> bucket&;
+};
+
+} // namespace detail
+} // namespace tpp
@@ -0,0 +1,318 @@
+#include "task_queue.h"
+#include <algorithm>
+
+namespace tpp
+{
+namespace detail
+{
+
+namespace
+{
+//-----------------------------------------------------------------------------
+/// Free nodes owned by a producer thread. Refilled from the pool of the
+/// queue being pushed to, so its size is bounded by the pool limit.
+//-----------------------------------------------------------------------------
+struct node_cache
+{
+    node_cache() = default;
+    node_cache(const node_cache&) = delete;
+    auto operator=(const node_cache&) -> node_cache& = delete;
+    ~node_cache()
+    {
+        while(head != nullptr)
+        {
+            auto next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+    }
+
+    void put(task_queue::node* n) noexcept
+    {
+        n->next.store(head, std::memory_order_relaxed);
+        head = n;
+    }
+
+    task_queue::node* head{};
+};
+
+auto get_node_cache() -> node_cache&
+{
+    static thread_local node_cache cache;
+    return cache;
+}
+
+// nodes freed by the consumer before they are handed to the producers
+constexpr std::size_t recycle_batch_size = 32;
+
+void free_list(task_queue::node* head) noexcept
+{
+    while(head != nullptr)
+    {
+        auto next = head->next.load(std::memory_order_relaxed);
+        delete head;
+        head = next;
+    }
+}
+} // namespace
+
+task_queue::task_queue() noexcept : back_(&stub_), front_(&stub_)
+{
+}
+
+task_queue::~task_queue()
+{
+    while(auto n = pop_node())
+    {
+        delete n;
+    }
+    free_list(freed_);
+    free_list(pool_.exchange(nullptr, std::memory_order_acquire));
+}
+
+void task_queue::push(task& callable)
+{
+    auto n = allocate();
+    n->callable = std::move(callable);
+
+    // count before linking so that size() never
+    // under-reports a task which is already reachable.
+    // sequentially consistent so that it orders against
+    // the consumer's sleeping flag
+    size_.fetch_add(1, std::memory_order_seq_cst);
+    push_node(n);
+}
+
+auto task_queue::push_bulk(task* callables, std::size_t count) -> std::size_t
+{
+    node* first = nullptr;
+    node* last = nullptr;
+    std::size_t pushed = 0;
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        if(!callables[i])
+        {
+            continue;
+        }
+
+        auto n = allocate();
+        n->callable = std::move(callables[i]);
+        if(last == nullptr)
+        {
+            first = n;
+        }
+        else
+        {
+            last->next.store(n, std::memory_order_relaxed);
+        }
+        last = n;
+        ++pushed;
+    }
+
+    if(pushed > 0)
+    {
+        size_.fetch_add(pushed, std::memory_order_seq_cst);
+        push_chain(first, last);
+    }
+    return pushed;
+}
+
+auto task_queue::try_push(task& callable, std::size_t capacity) -> bool
+{
+    auto n = allocate();
+
+    // reserve a place before linking so that concurrent
+    // producers cannot overshoot the capacity together
+    auto size = size_.load(std::memory_order_relaxed);
+    do
+    {
+        if(size >= capacity)
+        {
+            get_node_cache().put(n);
+            return false;
+        }
+    } while(!size_.compare_exchange_weak(size, size + 1, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+    n->callable = std::move(callable);
+    push_node(n);
+    return true;
+}
+
+auto task_queue::pop(task& callable) noexcept -> bool
+{
+    auto n = pop_node();
+    if(n == nullptr)
+    {
+        return false;
+    }
+
+    callable = std::move(n->callable);
+    recycle(n);
+    return true;
+}
+
+auto task_queue::allocate() -> node*
+{
+    auto& cache = get_node_cache();
+    if(cache.head == nullptr)
+    {
+        // take over everything the consumer has freed so far,
+        // looking first so that an empty pool costs no exchange
+        if(pool_.load(std::memory_order_relaxed) != nullptr)
+        {
+            cache.head = pool_.exchange(nullptr, std::memory_order_acquire);
+        }
+        if(cache.head == nullptr)
+        {
+            return new node();
+        }
+    }
+
+    auto n = cache.head;
+    cache.head = n->next.load(std::memory_order_relaxed);
+    n->next.store(nullptr, std::memory_order_relaxed);
+    return n;
+}
+
+void task_queue::recycle(node* n) noexcept
+{
+    if(freed_count_ + published_count_ >= pool_limit_)
+    {
+        // the producers may have taken the pool in the meantime
+        if(pool_.load(std::memory_order_relaxed) != nullptr || freed_count_ >= pool_limit_)
+        {
+            delete n;
+            return;
+        }
+        published_count_ = 0;
+    }
+
+    n->next.store(freed_, std::memory_order_relaxed);
+    freed_ = n;
+    if(freed_last_ == nullptr)
+    {
+        freed_last_ = n;
+    }
+    ++freed_count_;
+    pool_size_.store(freed_count_ + published_count_, std::memory_order_relaxed);
+
+    if(freed_count_ >= std::min(recycle_batch_size, pool_limit_))
+    {
+        publish_freed();
+    }
+}
+
+//-----------------------------------------------------------------------------
+/// Hands the nodes freed so far to the producers with a single exchange.
+/// Only the consumer pushes to the pool and producers only ever take it
+/// whole, so this cannot suffer from ABA and a non empty pool means that
+/// nothing was taken since the last publish.
+//-----------------------------------------------------------------------------
+void task_queue::publish_freed() noexcept
+{
+    if(freed_ == nullptr)
+    {
+        return;
+    }
+
+    auto head = pool_.load(std::memory_order_relaxed);
+    do
+    {
+        freed_last_->next.store(head, std::memory_order_relaxed);
+    } while(!pool_.compare_exchange_weak(head, freed_, std::memory_order_release, std::memory_order_relaxed));
+
+    published_count_ = head == nullptr ? freed_count_ : published_count_ + freed_count_;
+    pool_size_.store(published_count_, std::memory_order_relaxed);
+
+    freed_ = nullptr;
+    freed_last_ = nullptr;
+    freed_count_ = 0;
+}
+
+void task_queue::set_pool_size(std::size_t reserved, std::size_t limit)
+{
+    pool_limit_ = limit;
+    reserved = std::min(reserved, limit);
+    while(freed_count_ + published_count_ < reserved)
+    {
+        recycle(new node());
+    }
+    publish_freed();
+}
+
+void task_queue::push_node(node* n) noexcept
+{
+    push_chain(n, n);
+}
+
+void task_queue::push_chain(node* first, node* last) noexcept
+{
+    last->next.store(nullptr, std::memory_order_relaxed);
+    auto prev = back_.exchange(last, std::memory_order_acq_rel);
+    // publishes the whole chain to the consumer
+    prev->next.store(first, std::memory_order_release);
+}
+
+auto task_queue::pop_node() noexcept -> node*
+{
+    auto front = front_;
+    auto next = front->next.load(std::memory_order_acquire);
+
+    if(front == &stub_)
+    {
+        if(next == nullptr)
+        {
+            return nullptr;
+        }
+        front_ = next;
+        front = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if(next != nullptr)
+    {
+        front_ = next;
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        return front;
+    }
+
+    // a producer has swapped the back but not linked it yet
+    if(front != back_.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
+
+    // front is the last node, put the stub behind it
+    // so that it can be detached
+    push_node(&stub_);
+
+    next = front->next.load(std::memory_order_acquire);
+    if(next != nullptr)
+    {
+        front_ = next;
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        return front;
+    }
+
+    return nullptr;
+}
+
+auto task_queue::size() const noexcept -> std::size_t
+{
+    return size_.load(std::memory_order_seq_cst);
+}
+
+auto task_queue::empty() const noexcept -> bool
+{
+    return size() == 0;
+}
+
+auto task_queue::memory_usage() const noexcept -> std::size_t
+{
+    // the pooled count is approximate as producers take the pool silently
+    auto nodes = size_.load(std::memory_order_relaxed) + pool_size_.load(std::memory_order_relaxed);
+    return nodes * sizeof(node);
+}
+
+} // namespace detail
+} // namespace tpp
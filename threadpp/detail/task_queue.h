@@ -0,0 +1,110 @@
+#pragma once
+#include "../thread.h"
+#include <atomic>
+#include <cstddef>
+
+namespace tpp
+{
+namespace detail
+{
+
+//-----------------------------------------------------------------------------
+/// Intrusive multi-producer/single-consumer queue of tasks.
+/// Producers never block each other nor the consumer.
+/// Based on Dmitry Vyukov's intrusive MPSC node-based queue.
+/// Nodes are recycled rather than freed: the consumer returns them in
+/// batches to a per queue pool which producers take over whole into a
+/// thread local cache, so a steady flow of tasks does not allocate.
+//-----------------------------------------------------------------------------
+class task_queue
+{
+public:
+    struct node
+    {
+        std::atomic<node*> next{nullptr};
+        task callable;
+    };
+
+    task_queue() noexcept;
+    ~task_queue();
+
+    task_queue(task_queue&& rhs) = delete;
+    auto operator=(task_queue&& rhs) -> task_queue& = delete;
+
+    task_queue(const task_queue&) = delete;
+    auto operator=(const task_queue&) -> task_queue& = delete;
+
+    //-----------------------------------------------------------------------------
+    /// Enqueues a task. Can be called from any thread.
+    //-----------------------------------------------------------------------------
+    void push(task& callable);
+
+    //-----------------------------------------------------------------------------
+    /// Enqueues a batch of tasks with a single link operation so that they
+    /// become visible to the consumer together and in order. Empty tasks
+    /// are skipped. Can be called from any thread.
+    /// Returns the number of tasks enqueued.
+    //-----------------------------------------------------------------------------
+    auto push_bulk(task* callables, std::size_t count) -> std::size_t;
+
+    //-----------------------------------------------------------------------------
+    /// Enqueues a task only if fewer than capacity tasks are queued.
+    /// The task is left untouched if the queue is full.
+    /// Can be called from any thread. Returns false if the queue is full.
+    //-----------------------------------------------------------------------------
+    auto try_push(task& callable, std::size_t capacity) -> bool;
+
+    //-----------------------------------------------------------------------------
+    /// Dequeues the oldest task into callable. Must only be called by the
+    /// consumer. Returns false if the queue is empty or if the oldest
+    /// push is still in progress.
+    //-----------------------------------------------------------------------------
+    auto pop(task& callable) noexcept -> bool;
+
+    //-----------------------------------------------------------------------------
+    /// Sets how many free nodes the pool keeps, the rest are freed, and
+    /// fills it up to reserved nodes. Must only be called by the consumer.
+    //-----------------------------------------------------------------------------
+    void set_pool_size(std::size_t reserved, std::size_t limit);
+
+    //-----------------------------------------------------------------------------
+    /// Returns the number of tasks pushed but not yet popped.
+    //-----------------------------------------------------------------------------
+    auto size() const noexcept -> std::size_t;
+    auto empty() const noexcept -> bool;
+
+    //-----------------------------------------------------------------------------
+    /// Returns the bytes held by the queued and the pooled nodes.
+    /// Nodes cached by producer threads are not included.
+    //-----------------------------------------------------------------------------
+    auto memory_usage() const noexcept -> std::size_t;
+
+private:
+    auto allocate() -> node*;
+    void recycle(node* n) noexcept;
+    void publish_freed() noexcept;
+    auto pop_node() noexcept -> node*;
+    void push_node(node* n) noexcept;
+    void push_chain(node* first, node* last) noexcept;
+
+    /// producers side
+    std::atomic<node*> back_;
+    std::atomic<std::size_t> size_{0};
+
+    /// consumer side
+    node* front_;
+    node stub_;
+    node* freed_{};
+    node* freed_last_{};
+    std::size_t freed_count_{0};
+    std::size_t published_count_{0};
+    std::size_t pool_limit_{256};
+
+    /// free nodes, pushed by the consumer and taken all at once by producers
+    std::atomic<node*> pool_{nullptr};
+    /// free nodes known to the consumer, kept for the memory usage
+    std::atomic<std::size_t> pool_size_{0};
+};
+
+} // namespace detail
+} // namespace tpp
@@ -0,0 +1,322 @@
+#include "timer_wheel.h"
+#include <algorithm>
+#include <limits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace tpp
+{
+namespace detail
+{
+
+namespace
+{
+// pseudo levels of the nodes which are not in a slot
+constexpr std::uint8_t current_level = timer_wheel::levels_count;
+constexpr std::uint8_t due_level = timer_wheel::levels_count + 1;
+
+constexpr std::uint64_t slot_mask = timer_wheel::slots_count - 1;
+constexpr std::uint64_t max_ticks = (std::uint64_t(1) << (timer_wheel::slot_bits * timer_wheel::levels_count)) - 1;
+
+auto lowest_bit(std::uint64_t value) noexcept -> std::size_t
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return static_cast<std::size_t>(__builtin_ctzll(value));
+#endif
+}
+
+auto highest_bit(std::uint64_t value) noexcept -> std::size_t
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return static_cast<std::size_t>(63 - __builtin_clzll(value));
+#endif
+}
+
+auto rotate_right(std::uint64_t value, std::size_t count) noexcept -> std::uint64_t
+{
+    return count == 0 ? value : (value >> count) | (value << (64 - count));
+}
+} // namespace
+
+void timer_list::push_back(timer_node* node) noexcept
+{
+    node->prev = tail;
+    node->next = nullptr;
+    if(tail != nullptr)
+    {
+        tail->next = node;
+    }
+    else
+    {
+        head = node;
+    }
+    tail = node;
+}
+
+void timer_list::erase(timer_node* node) noexcept
+{
+    if(node->prev != nullptr)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        head = node->next;
+    }
+
+    if(node->next != nullptr)
+    {
+        node->next->prev = node->prev;
+    }
+    else
+    {
+        tail = node->prev;
+    }
+    node->prev = nullptr;
+    node->next = nullptr;
+}
+
+auto timer_list::pop_front() noexcept -> timer_node*
+{
+    auto node = head;
+    if(node != nullptr)
+    {
+        erase(node);
+    }
+    return node;
+}
+
+timer_wheel::timer_wheel() noexcept : epoch_(clock::now())
+{
+}
+
+void timer_wheel::insert(timer_node* node) noexcept
+{
+    node->linked = true;
+    ++size_;
+
+    auto when = to_tick(node->deadline);
+    if(when <= elapsed_)
+    {
+        node->level = current_level;
+        current_.push_back(node);
+        current_deadline_ = std::min(current_deadline_, node->deadline);
+        next_deadline_ = std::min(next_deadline_, node->deadline);
+        return;
+    }
+
+    // timers beyond the range of the wheel wait in the last
+    // level and are placed again once their slot comes up
+    when = std::min(when, elapsed_ + max_ticks);
+
+    // the level is picked by the highest bit in which the
+    // deadline differs from the elapsed time
+    auto level = std::min(highest_bit((elapsed_ ^ when) | slot_mask) / slot_bits, levels_count - 1);
+    auto shift = level * slot_bits;
+    auto slot = (when >> shift) & slot_mask;
+
+    node->level = static_cast<std::uint8_t>(level);
+    node->slot = static_cast<std::uint8_t>(slot);
+    slots_[level][slot].push_back(node);
+    occupied_[level] |= std::uint64_t(1) << slot;
+
+    auto slot_start = level == 0 ? node->deadline : to_time(when & ~((std::uint64_t(1) << shift) - 1));
+    next_deadline_ = std::min(next_deadline_, slot_start);
+}
+
+void timer_wheel::remove(timer_node* node) noexcept
+{
+    node->linked = false;
+    --size_;
+
+    if(node->level == current_level)
+    {
+        current_.erase(node);
+    }
+    else if(node->level == due_level)
+    {
+        due_.erase(node);
+    }
+    else
+    {
+        auto& list = slots_[node->level][node->slot];
+        list.erase(node);
+        if(list.empty())
+        {
+            occupied_[node->level] &= ~(std::uint64_t(1) << node->slot);
+        }
+    }
+}
+
+auto timer_wheel::pop_due(clock::time_point now) noexcept -> timer_node*
+{
+    if(due_.empty())
+    {
+        if(now < next_deadline_)
+        {
+            return nullptr;
+        }
+        advance(now);
+    }
+
+    auto node = due_.pop_front();
+    if(node != nullptr)
+    {
+        node->linked = false;
+        --size_;
+    }
+    return node;
+}
+
+auto timer_wheel::next_deadline() const noexcept -> clock::time_point
+{
+    return due_.empty() ? next_deadline_ : clock::time_point::min();
+}
+
+auto timer_wheel::size() const noexcept -> std::size_t
+{
+    return size_;
+}
+
+auto timer_wheel::empty() const noexcept -> bool
+{
+    return size_ == 0;
+}
+
+auto timer_wheel::to_tick(clock::time_point time) const noexcept -> std::uint64_t
+{
+    if(time <= epoch_)
+    {
+        return 0;
+    }
+    return static_cast<std::uint64_t>((time - epoch_) / tick(1));
+}
+
+auto timer_wheel::to_time(std::uint64_t ticks) const noexcept -> clock::time_point
+{
+    return epoch_ + std::chrono::duration_cast<clock::duration>(tick(ticks));
+}
+
+//-----------------------------------------------------------------------------
+/// Finds the occupied slot which comes up first. Within a level the slots
+/// are searched starting from the one holding the elapsed time, so the
+/// ones before it belong to the next revolution of the level.
+//-----------------------------------------------------------------------------
+auto timer_wheel::next_expiration(std::size_t& level, std::size_t& slot) const noexcept -> std::uint64_t
+{
+    auto result = std::numeric_limits<std::uint64_t>::max();
+    for(std::size_t i = 0; i < levels_count; ++i)
+    {
+        auto occupied = occupied_[i];
+        if(occupied == 0)
+        {
+            continue;
+        }
+
+        auto shift = i * slot_bits;
+        auto elapsed_slot = static_cast<std::size_t>((elapsed_ >> shift) & slot_mask);
+        auto next_slot = (elapsed_slot + lowest_bit(rotate_right(occupied, elapsed_slot))) & slot_mask;
+
+        auto level_range = std::uint64_t(1) << (shift + slot_bits);
+        auto when = (elapsed_ & ~(level_range - 1)) + (std::uint64_t(next_slot) << shift);
+        if(when <= elapsed_)
+        {
+            when += level_range;
+        }
+
+        if(when < result)
+        {
+            result = when;
+            level = i;
+            slot = next_slot;
+        }
+    }
+    return result;
+}
+
+void timer_wheel::advance(clock::time_point now) noexcept
+{
+    // the elapsed tick is only partially over
+    if(now >= current_deadline_)
+    {
+        current_deadline_ = clock::time_point::max();
+        auto node = current_.head;
+        while(node != nullptr)
+        {
+            auto next = node->next;
+            if(node->deadline <= now)
+            {
+                current_.erase(node);
+                node->level = due_level;
+                due_.push_back(node);
+            }
+            else
+            {
+                current_deadline_ = std::min(current_deadline_, node->deadline);
+            }
+            node = next;
+        }
+    }
+
+    // visit the slots in order, moving their timers down
+    // a level or to the due list
+    auto target = to_tick(now);
+    while(true)
+    {
+        std::size_t level = 0;
+        std::size_t slot = 0;
+        auto when = next_expiration(level, slot);
+        if(when > target)
+        {
+            break;
+        }
+
+        elapsed_ = when;
+        auto list = slots_[level][slot];
+        slots_[level][slot] = {};
+        occupied_[level] &= ~(std::uint64_t(1) << slot);
+
+        while(auto node = list.pop_front())
+        {
+            if(node->deadline <= now)
+            {
+                node->level = due_level;
+                due_.push_back(node);
+            }
+            else
+            {
+                --size_;
+                insert(node);
+            }
+        }
+    }
+    elapsed_ = std::max(elapsed_, target);
+
+    update_next_deadline();
+}
+
+void timer_wheel::update_next_deadline() noexcept
+{
+    next_deadline_ = current_deadline_;
+
+    std::size_t level = 0;
+    std::size_t slot = 0;
+    auto when = next_expiration(level, slot);
+    if(when != std::numeric_limits<std::uint64_t>::max())
+    {
+        next_deadline_ = std::min(next_deadline_, to_time(when));
+    }
+}
+
+} // namespace detail
+} // namespace tpp
@@ -0,0 +1,173 @@
+#pragma once
+#include "../thread.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace tpp
+{
+namespace detail
+{
+
+enum class timer_state : std::uint32_t
+{
+    scheduled,
+    fired,
+    cancelled
+};
+
+//-----------------------------------------------------------------------------
+/// A task scheduled to run on a thread at a deadline and optionally
+/// every period after that. Shared by the owning thread and the timer
+/// handles. Only the owning thread touches the links and the callable.
+//-----------------------------------------------------------------------------
+struct timer_node
+{
+    /// owner side, valid while linked into the wheel
+    timer_node* prev{};
+    timer_node* next{};
+    std::uint8_t level{};
+    std::uint8_t slot{};
+    bool linked{false};
+
+    /// links of the stacks feeding the owner from other threads
+    timer_node* next_scheduled{};
+    timer_node* next_cancelled{};
+
+    clock::time_point deadline{};
+    clock::duration period{};
+    task callable;
+    thread::id owner{};
+
+    std::atomic<timer_state> state{timer_state::scheduled};
+    std::atomic<std::uint32_t> refs{1};
+};
+
+inline void release_ref(timer_node* node) noexcept
+{
+    if(node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete node;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/// Intrusive FIFO list of timer nodes.
+//-----------------------------------------------------------------------------
+struct timer_list
+{
+    void push_back(timer_node* node) noexcept;
+    void erase(timer_node* node) noexcept;
+    auto pop_front() noexcept -> timer_node*;
+    auto empty() const noexcept -> bool
+    {
+        return head == nullptr;
+    }
+
+    timer_node* head{};
+    timer_node* tail{};
+};
+
+//-----------------------------------------------------------------------------
+/// Hierarchical timer wheel with a resolution of a millisecond.
+/// Each level has 64 slots, each one 64 times wider than the ones of the
+/// level below. Inserting and removing are O(1) and a timer is moved
+/// down at most once per level as its deadline approaches.
+/// Timers are still fired at their exact deadline. Owner thread only.
+//-----------------------------------------------------------------------------
+class timer_wheel
+{
+public:
+    static constexpr std::size_t slot_bits = 6;
+    static constexpr std::size_t slots_count = std::size_t(1) << slot_bits;
+    static constexpr std::size_t levels_count = 6;
+    using tick = std::chrono::milliseconds;
+
+    timer_wheel() noexcept;
+
+    timer_wheel(const timer_wheel&) = delete;
+    auto operator=(const timer_wheel&) -> timer_wheel& = delete;
+
+    //-----------------------------------------------------------------------------
+    /// Links a node by its deadline.
+    //-----------------------------------------------------------------------------
+    void insert(timer_node* node) noexcept;
+
+    //-----------------------------------------------------------------------------
+    /// Unlinks a node which is linked into this wheel.
+    //-----------------------------------------------------------------------------
+    void remove(timer_node* node) noexcept;
+
+    //-----------------------------------------------------------------------------
+    /// Unlinks and returns the next node whose deadline is not after now.
+    /// Returns nullptr if there is none.
+    //-----------------------------------------------------------------------------
+    auto pop_due(clock::time_point now) noexcept -> timer_node*;
+
+    //-----------------------------------------------------------------------------
+    /// Returns the earliest time at which pop_due may return a node,
+    /// or clock::time_point::max() if the wheel is empty. Can be earlier
+    /// than any deadline when a node was removed or has to be moved down.
+    //-----------------------------------------------------------------------------
+    auto next_deadline() const noexcept -> clock::time_point;
+
+    auto size() const noexcept -> std::size_t;
+    auto empty() const noexcept -> bool;
+
+    //-----------------------------------------------------------------------------
+    /// Unlinks every node, calling f for each of them.
+    //-----------------------------------------------------------------------------
+    template<typename F>
+    void clear(F&& f);
+
+private:
+    auto to_tick(clock::time_point time) const noexcept -> std::uint64_t;
+    auto to_time(std::uint64_t ticks) const noexcept -> clock::time_point;
+    auto next_expiration(std::size_t& level, std::size_t& slot) const noexcept -> std::uint64_t;
+    void advance(clock::time_point now) noexcept;
+    void update_next_deadline() noexcept;
+
+    clock::time_point epoch_;
+    std::uint64_t elapsed_{0};
+    std::array<std::uint64_t, levels_count> occupied_{};
+    std::array<std::array<timer_list, slots_count>, levels_count> slots_{};
+    /// in the elapsed tick but not yet at their deadline
+    timer_list current_;
+    clock::time_point current_deadline_{clock::time_point::max()};
+    timer_list due_;
+    clock::time_point next_deadline_{clock::time_point::max()};
+    std::size_t size_{0};
+};
+
+template<typename F>
+void timer_wheel::clear(F&& f)
+{
+    auto clear_list = [&](timer_list& list)
+    {
+        while(auto node = list.pop_front())
+        {
+            node->linked = false;
+            f(node);
+        }
+    };
+
+    for(auto& level : slots_)
+    {
+        for(auto& list : level)
+        {
+            clear_list(list);
+        }
+    }
+    clear_list(current_);
+    clear_list(due_);
+
+    occupied_.fill(0);
+    current_deadline_ = clock::time_point::max();
+    next_deadline_ = clock::time_point::max();
+    size_ = 0;
+}
+
+} // namespace detail
+} // namespace tpp
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tpp
+{
+template<typename Signature, std::size_t BufferSize = 64>
+class unique_function;
+
+namespace detail
+{
+
+template<typename R, typename... Args>
+struct function_vtable
+{
+    R (*call)(void* storage, Args&&... args);
+    void (*move)(void* dst, void* src);
+    void (*destroy)(void* storage);
+};
+
+//-----------------------------------------------------------------------------
+/// Callable stored directly inside the buffer.
+//-----------------------------------------------------------------------------
+template<typename F, typename R, typename... Args>
+struct inline_function_ops
+{
+    static auto get(void* storage) noexcept -> F&
+    {
+        return *static_cast<F*>(storage);
+    }
+
+    static auto call(void* storage, Args&&... args) -> R
+    {
+        return static_cast<R>(get(storage)(std::forward<Args>(args)...));
+    }
+
+    static void move(void* dst, void* src)
+    {
+        ::new(dst) F(std::move(get(src)));
+        get(src).~F();
+    }
+
+    static void destroy(void* storage)
+    {
+        get(storage).~F();
+    }
+
+    static const function_vtable<R, Args...> table;
+};
+
+template<typename F, typename R, typename... Args>
+const function_vtable<R, Args...> inline_function_ops<F, R, Args...>::table = {&call, &move, &destroy};
+
+//-----------------------------------------------------------------------------
+/// Callable too big for the buffer. Only a pointer to it is stored.
+//-----------------------------------------------------------------------------
+template<typename F, typename R, typename... Args>
+struct heap_function_ops
+{
+    static auto get(void* storage) noexcept -> F*&
+    {
+        return *static_cast<F**>(storage);
+    }
+
+    static auto call(void* storage, Args&&... args) -> R
+    {
+        return static_cast<R>((*get(storage))(std::forward<Args>(args)...));
+    }
+
+    static void move(void* dst, void* src)
+    {
+        ::new(dst) F*(get(src));
+    }
+
+    static void destroy(void* storage)
+    {
+        delete get(storage);
+    }
+
+    static const function_vtable<R, Args...> table;
+};
+
+template<typename F, typename R, typename... Args>
+const function_vtable<R, Args...> heap_function_ops<F, R, Args...>::table = {&call, &move, &destroy};
+
+template<typename F>
+auto is_null_callable(const F& f) noexcept
+    -> std::enable_if_t<std::is_pointer<F>::value || std::is_member_pointer<F>::value, bool>
+{
+    return f == nullptr;
+}
+
+template<typename F>
+auto is_null_callable(const F&) noexcept
+    -> std::enable_if_t<!std::is_pointer<F>::value && !std::is_member_pointer<F>::value, bool>
+{
+    return false;
+}
+
+template<typename T>
+struct is_unique_function : std::false_type
+{
+};
+
+template<typename Signature, std::size_t BufferSize>
+struct is_unique_function<unique_function<Signature, BufferSize>> : std::true_type
+{
+};
+
+} // namespace detail
+
+//-----------------------------------------------------------------------------
+/// Move-only polymorphic function wrapper. Unlike std::function it
+/// accepts move-only callables and stores any callable up to BufferSize
+/// bytes inline, so wrapping it does not allocate.
+//-----------------------------------------------------------------------------
+template<typename R, typename... Args, std::size_t BufferSize>
+class unique_function<R(Args...), BufferSize>
+{
+    using vtable_type = detail::function_vtable<R, Args...>;
+    using storage_type = std::aligned_storage_t<BufferSize, alignof(std::max_align_t)>;
+
+    template<typename F>
+    using stored_inline = std::integral_constant<bool,
+                                                 sizeof(F) <= sizeof(storage_type) &&
+                                                     alignof(storage_type) % alignof(F) == 0 &&
+                                                     std::is_nothrow_move_constructible<F>::value>;
+
+public:
+    unique_function() noexcept = default;
+
+    unique_function(std::nullptr_t) noexcept
+    {
+    }
+
+    template<typename F,
+             typename Callable = std::decay_t<F>,
+             typename = std::enable_if_t<!detail::is_unique_function<Callable>::value>>
+    unique_function(F&& f)
+    {
+        if(detail::is_null_callable(f))
+        {
+            return;
+        }
+        construct<Callable>(std::forward<F>(f), stored_inline<Callable>{});
+    }
+
+    template<typename Signature, std::size_t OtherBufferSize>
+    unique_function(unique_function<Signature, OtherBufferSize>&& rhs)
+    {
+        if(rhs)
+        {
+            using Callable = unique_function<Signature, OtherBufferSize>;
+            construct<Callable>(std::move(rhs), stored_inline<Callable>{});
+        }
+    }
+
+    unique_function(unique_function&& rhs) noexcept
+    {
+        move_from(rhs);
+    }
+
+    auto operator=(unique_function&& rhs) noexcept -> unique_function&
+    {
+        if(this != &rhs)
+        {
+            reset();
+            move_from(rhs);
+        }
+        return *this;
+    }
+
+    auto operator=(std::nullptr_t) noexcept -> unique_function&
+    {
+        reset();
+        return *this;
+    }
+
+    unique_function(const unique_function&) = delete;
+    auto operator=(const unique_function&) -> unique_function& = delete;
+
+    ~unique_function()
+    {
+        reset();
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Invokes the stored callable. Throws std::bad_function_call if empty.
+    //-----------------------------------------------------------------------------
+    auto operator()(Args... args) -> R
+    {
+        if(vtable_ == nullptr)
+        {
+            throw std::bad_function_call();
+        }
+        return vtable_->call(&storage_, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return vtable_ != nullptr;
+    }
+
+    void swap(unique_function& rhs) noexcept
+    {
+        unique_function tmp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    template<typename Callable, typename F>
+    void construct(F&& f, std::true_type /*stored_inline*/)
+    {
+        ::new(&storage_) Callable(std::forward<F>(f));
+        vtable_ = &detail::inline_function_ops<Callable, R, Args...>::table;
+    }
+
+    template<typename Callable, typename F>
+    void construct(F&& f, std::false_type /*stored_inline*/)
+    {
+        ::new(&storage_) Callable*(new Callable(std::forward<F>(f)));
+        vtable_ = &detail::heap_function_ops<Callable, R, Args...>::table;
+    }
+
+    void move_from(unique_function& rhs) noexcept
+    {
+        if(rhs.vtable_ != nullptr)
+        {
+            rhs.vtable_->move(&storage_, &rhs.storage_);
+            vtable_ = rhs.vtable_;
+            rhs.vtable_ = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if(vtable_ != nullptr)
+        {
+            vtable_->destroy(&storage_);
+            vtable_ = nullptr;
+        }
+    }
+
+    storage_type storage_;
+    const vtable_type* vtable_{};
+};
+
+template<typename Signature, std::size_t BufferSize>
+inline auto operator==(const unique_function<Signature, BufferSize>& f, std::nullptr_t) noexcept -> bool
+{
+    return !f;
+}
+
+template<typename Signature, std::size_t BufferSize>
+inline auto operator==(std::nullptr_t, const unique_function<Signature, BufferSize>& f) noexcept -> bool
+{
+    return !f;
+}
+
+template<typename Signature, std::size_t BufferSize>
+inline auto operator!=(const unique_function<Signature, BufferSize>& f, std::nullptr_t) noexcept -> bool
+{
+    return static_cast<bool>(f);
+}
+
+template<typename Signature, std::size_t BufferSize>
+inline auto operator!=(std::nullptr_t, const unique_function<Signature, BufferSize>& f) noexcept -> bool
+{
+    return static_cast<bool>(f);
+}
+
+} // namespace tpp
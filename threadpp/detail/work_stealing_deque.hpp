@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace tpp
+{
+namespace detail
+{
+
+//-----------------------------------------------------------------------------
+/// Chase-Lev work stealing deque. The owner pushes and pops at the bottom
+/// (LIFO) while any other thread can steal from the top (FIFO).
+/// Based on "Correct and Efficient Work-Stealing for Weak Memory Models"
+/// by Le, Pop, Cohen and Zappa Nardelli. The buffer grows as needed,
+/// retired buffers are kept alive until destruction as thieves
+/// may still be reading from them.
+//-----------------------------------------------------------------------------
+template<typename T>
+class work_stealing_deque
+{
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+    struct buffer
+    {
+        explicit buffer(std::int64_t cap) : capacity(cap), items(new std::atomic<T>[static_cast<std::size_t>(cap)])
+        {
+        }
+
+        auto get(std::int64_t i) const noexcept -> T
+        {
+            return items[static_cast<std::size_t>(i & (capacity - 1))].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t i, T item) noexcept
+        {
+            items[static_cast<std::size_t>(i & (capacity - 1))].store(item, std::memory_order_relaxed);
+        }
+
+        std::int64_t capacity;
+        std::unique_ptr<std::atomic<T>[]> items;
+    };
+
+public:
+    explicit work_stealing_deque(std::int64_t capacity = 64)
+    {
+        // capacity must be a power of two
+        std::int64_t cap = 1;
+        while(cap < capacity)
+        {
+            cap <<= 1;
+        }
+        buffers_.emplace_back(std::make_unique<buffer>(cap));
+        buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+    }
+
+    work_stealing_deque(const work_stealing_deque&) = delete;
+    auto operator=(const work_stealing_deque&) -> work_stealing_deque& = delete;
+
+    //-----------------------------------------------------------------------------
+    /// Pushes an item at the bottom. Must only be called by the owner.
+    //-----------------------------------------------------------------------------
+    void push(T item)
+    {
+        auto b = bottom_.load(std::memory_order_relaxed);
+        auto t = top_.load(std::memory_order_acquire);
+        auto a = buffer_.load(std::memory_order_relaxed);
+        if(b - t > a->capacity - 1)
+        {
+            a = grow(a, b, t);
+        }
+        a->put(b, item);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Pops the most recently pushed item. Must only be called by the owner.
+    /// Returns a value initialized T if empty.
+    //-----------------------------------------------------------------------------
+    auto pop() -> T
+    {
+        auto b = bottom_.load(std::memory_order_relaxed) - 1;
+        auto a = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_seq_cst);
+        auto t = top_.load(std::memory_order_seq_cst);
+
+        T item{};
+        if(t <= b)
+        {
+            item = a->get(b);
+            if(t == b)
+            {
+                // last item, race against the thieves for it
+                if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    item = T{};
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Steals the oldest item. Can be called from any thread.
+    /// Returns a value initialized T if empty or if it lost a race.
+    //-----------------------------------------------------------------------------
+    auto steal() -> T
+    {
+        auto t = top_.load(std::memory_order_seq_cst);
+        auto b = bottom_.load(std::memory_order_seq_cst);
+
+        if(t < b)
+        {
+            auto a = buffer_.load(std::memory_order_acquire);
+            auto item = a->get(t);
+            if(top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return item;
+            }
+        }
+        return T{};
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Returns an approximation of the number of items.
+    //-----------------------------------------------------------------------------
+    auto size() const noexcept -> std::size_t
+    {
+        auto b = bottom_.load(std::memory_order_relaxed);
+        auto t = top_.load(std::memory_order_relaxed);
+        return b > t ? static_cast<std::size_t>(b - t) : 0;
+    }
+
+    auto empty() const noexcept -> bool
+    {
+        return size() == 0;
+    }
+
+private:
+    auto grow(buffer* a, std::int64_t b, std::int64_t t) -> buffer*
+    {
+        buffers_.emplace_back(std::make_unique<buffer>(a->capacity * 2));
+        auto grown = buffers_.back().get();
+        for(auto i = t; i < b; ++i)
+        {
+            grown->put(i, a->get(i));
+        }
+        buffer_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    std::atomic<std::int64_t> top_{0};
+    std::atomic<std::int64_t> bottom_{0};
+    std::atomic<buffer*> buffer_{nullptr};
+
+    /// owner side, current and retired buffers
+    std::vector<std::unique_ptr<buffer>> buffers_;
+};
+
+} // namespace detail
+} // namespace tpp
@@ -1,10 +1,10 @@
 #pragma once
 #include "detail/future_state.hpp"
 #include "detail/utility/apply.hpp"
-#include "detail/utility/capture.hpp"
 #include "detail/utility/invoke.hpp"
 
 #include "thread.h"
+#include <cstdint>
 #include <future>
 
 namespace tpp
@@ -26,6 +26,19 @@ using async_ret_type = callable_ret_type<F, Args...>;
 template<typename F, typename T>
 using then_ret_type = callable_ret_type<F, T>;
 
+//-----------------------------------------------------------------------------
+/// Launch policy for then(). The continuation runs right away on the thread
+/// which makes the antecedent ready, or on the attaching thread if it
+/// already is, instead of being queued. Suited for cheap continuations.
+/// Inline continuations nested deeper than max_depth are queued to the
+/// default executor instead so that long chains do not overflow the stack.
+//-----------------------------------------------------------------------------
+struct launch_inline_t
+{
+    static constexpr std::uint32_t max_depth = 64;
+};
+constexpr launch_inline_t launch_inline{};
+
 //-----------------------------------------------------------------------------
 /// The template function async runs the function f a
 /// synchronously (potentially in a separate thread )
@@ -36,10 +49,15 @@ using then_ret_type = callable_ret_type<F, T>;
 /// Policy deferred will only queue it if the calling thread
 /// and the destination thread are different otherwise it
 /// will immediately execute the task.
+/// The overloads without a destination run on the default executor
+/// which can be configured through init_data::default_executor.
 //-----------------------------------------------------------------------------
 template<typename F, typename... Args>
 auto async(thread::id id, std::launch policy, F&& f, Args&&... args) -> future<async_ret_type<F, Args...>>;
 template<typename F, typename... Args>
+auto async(const thread_handle& handle, std::launch policy, F&& f, Args&&... args)
+    -> future<async_ret_type<F, Args...>>;
+template<typename F, typename... Args>
 auto async(std::launch policy, F&& f, Args&&... args) -> future<async_ret_type<F, Args...>>;
 
 //-----------------------------------------------------------------------------
@@ -51,6 +69,8 @@ auto async(std::launch policy, F&& f, Args&&... args) -> future<async_ret_type<F
 template<typename F, typename... Args>
 auto async(thread::id id, F&& f, Args&&... args) -> future<async_ret_type<F, Args...>>;
 template<typename F, typename... Args>
+auto async(const thread_handle& handle, F&& f, Args&&... args) -> future<async_ret_type<F, Args...>>;
+template<typename F, typename... Args>
 auto async(F&& f, Args&&... args) -> future<async_ret_type<F, Args...>>;
 
 //-----------------------------------------------------------------------------
@@ -330,6 +350,13 @@ public:
     template<typename F>
     auto then(std::launch policy, F&& f) -> future<then_ret_type<F, future<T>>>;
 
+    //-----------------------------------------------------------------------------
+    /// Attach the continuation func to *this to be run inline on the thread
+    /// which makes *this ready, see launch_inline.
+    //-----------------------------------------------------------------------------
+    template<typename F>
+    auto then(launch_inline_t policy, F&& f) -> future<then_ret_type<F, future<T>>>;
+
     //-----------------------------------------------------------------------------
     /// Attach the continuation func to *this. The behavior is undefined
     /// if *this has no associated shared state (i.e., valid() == false).
@@ -393,6 +420,13 @@ public:
     template<typename F>
     auto then(std::launch policy, F&& f) -> future<then_ret_type<F, future<void>>>;
 
+    //-----------------------------------------------------------------------------
+    /// Attach the continuation func to *this to be run inline on the thread
+    /// which makes *this ready, see launch_inline.
+    //-----------------------------------------------------------------------------
+    template<typename F>
+    auto then(launch_inline_t policy, F&& f) -> future<then_ret_type<F, future<void>>>;
+
     //-----------------------------------------------------------------------------
     /// Attach the continuation func to *this. The behavior is undefined
     /// if *this has no associated shared state (i.e., valid() == false).
@@ -461,6 +495,13 @@ public:
     template<typename F>
     auto then(std::launch policy, F&& f) const -> future<then_ret_type<F, shared_future<T>>>;
 
+    //-----------------------------------------------------------------------------
+    /// Attach the continuation func to *this to be run inline on the thread
+    /// which makes *this ready, see launch_inline.
+    //-----------------------------------------------------------------------------
+    template<typename F>
+    auto then(launch_inline_t policy, F&& f) const -> future<then_ret_type<F, shared_future<T>>>;
+
     //-----------------------------------------------------------------------------
     /// Attach the continuation func to *this. The behavior is undefined
     /// if *this has no associated shared state (i.e., valid() == false).
@@ -527,6 +568,13 @@ public:
     template<typename F>
     auto then(std::launch policy, F&& f) const -> future<then_ret_type<F, shared_future<void>>>;
 
+    //-----------------------------------------------------------------------------
+    /// Attach the continuation func to *this to be run inline on the thread
+    /// which makes *this ready, see launch_inline.
+    //-----------------------------------------------------------------------------
+    template<typename F>
+    auto then(launch_inline_t policy, F&& f) const -> future<then_ret_type<F, shared_future<void>>>;
+
     //-----------------------------------------------------------------------------
     /// Attach the continuation func to *this. The behavior is undefined
     /// if *this has no associated shared state (i.e., valid() == false).
@@ -619,34 +667,27 @@ auto package_future_task(F&& f, Args&&... args) -> packaged_task<async_ret_type<
     auto prom = promise<return_type>();
     auto fut = prom.get_future();
 
-    // clang-format off
-
-    // All this ugliness is to minimize copies and moves
-	return {std::move(fut),
-                [
-                    p = capture(std::move(prom)),
-                    f = capture(std::forward<F>(f)),
-                    params = capture(std::forward<Args>(args)...)
-                ]() mutable {
-
-				try
-				{
-					detail::apply_and_forward_as<Args...>(
-						std::get<0>(p.get()), std::forward<F>(std::get<0>(f.get())), params.get());
-				}
-				catch(...)
-				{
-					try
-					{
-						// store anything thrown in the promise
-						std::get<0>(p.get()).set_exception(std::current_exception());
-					}
-					catch(...)
-					{
-					} // set_exception() may throw too
-				}
-			}};
-    // clang-format on
+    return {std::move(fut),
+            [p = std::move(prom),
+             f = std::forward<F>(f),
+             params = std::make_tuple(std::forward<Args>(args)...)]() mutable
+            {
+                try
+                {
+                    detail::apply_and_forward_as<Args...>(p, std::forward<F>(f), params);
+                }
+                catch(...)
+                {
+                    try
+                    {
+                        // store anything thrown in the promise
+                        p.set_exception(std::current_exception());
+                    }
+                    catch(...)
+                    {
+                    } // set_exception() may throw too
+                }
+            }};
 }
 
 inline void launch(thread::id id, std::launch policy, task& func)
@@ -677,6 +718,83 @@ inline void launch(thread::id id, std::launch policy, task& func)
         }
     }
 }
+
+inline void launch(const thread_handle& handle, std::launch policy, task& func)
+{
+    if(policy == std::launch::async)
+    {
+        detail::invoke_packaged_task(handle, func);
+    }
+    else
+    {
+        if(this_thread::get_id() == handle.get_id())
+        {
+            // directly call it
+            func();
+        }
+        else
+        {
+            detail::invoke_packaged_task(handle, func);
+        }
+    }
+}
+
+inline void launch(std::launch /*policy*/, task& func)
+{
+    // the default executor never runs on the calling
+    // thread so the task is always queued
+    detail::invoke_default_executor(func);
+}
+
+inline auto get_inline_depth() -> std::uint32_t&
+{
+    static thread_local std::uint32_t depth = 0;
+    return depth;
+}
+
+inline void launch(launch_inline_t /*policy*/, task& func)
+{
+    auto& depth = get_inline_depth();
+    if(depth >= launch_inline_t::max_depth)
+    {
+        // a long chain of inline continuations,
+        // continue it on a fresh stack
+        detail::invoke_default_executor(func);
+        return;
+    }
+
+    ++depth;
+    // packaged tasks do not throw
+    func();
+    --depth;
+}
+
+//-----------------------------------------------------------------------------
+/// Attaches f as the continuation of state. Once the state is ready it is
+/// packaged along with a future to the state and passed to launcher, which
+/// decides where it runs.
+//-----------------------------------------------------------------------------
+template<typename Future, typename State, typename F, typename Launcher>
+auto then_continuation(State state, F&& f, Launcher launcher) -> future<then_ret_type<F, Future>>
+{
+    auto package = detail::package_future_task(
+        [f = std::forward<F>(f), state]() mutable
+        {
+            Future self;
+            self._internal_set_state(state);
+            return utility::invoke(f, std::move(self));
+        });
+    auto& future = package.callable_future;
+    auto& task = package.callable;
+
+    state->set_continuation(
+        [launcher = std::move(launcher), task = std::move(task)]() mutable
+        {
+            launcher(task);
+        });
+
+    return std::move(future);
+}
 } // namespace detail
 
 template<typename F, typename... Args>
@@ -697,18 +815,38 @@ auto async(thread::id id, F&& f, Args&&... args) -> future<async_ret_type<F, Arg
     return async(id, std::launch::deferred | std::launch::async, std::forward<F>(f), std::forward<Args>(args)...);
 }
 
+template<typename F, typename... Args>
+auto async(const thread_handle& handle, std::launch policy, F&& f, Args&&... args)
+    -> future<async_ret_type<F, Args...>>
+{
+    auto package = detail::package_future_task(std::forward<F>(f), std::forward<Args>(args)...);
+    auto& future = package.callable_future;
+    auto& task = package.callable;
+
+    detail::launch(handle, policy, task);
+
+    return std::move(future);
+}
+
+template<typename F, typename... Args>
+auto async(const thread_handle& handle, F&& f, Args&&... args) -> future<async_ret_type<F, Args...>>
+{
+    return async(handle,
+                 std::launch::deferred | std::launch::async,
+                 std::forward<F>(f),
+                 std::forward<Args>(args)...);
+}
+
 template<typename F, typename... Args>
 auto async(std::launch policy, F&& f, Args&&... args) -> future<async_ret_type<F, Args...>>
 {
-    thread detached_thread(
-        []()
-        {
-            this_thread::register_this_thread();
-            this_thread::wait();
-            this_thread::unregister_this_thread();
-        });
-    detached_thread.detach();
-    return async(detached_thread.get_id(), policy, std::forward<F>(f), std::forward<Args>(args)...);
+    auto package = detail::package_future_task(std::forward<F>(f), std::forward<Args>(args)...);
+    auto& future = package.callable_future;
+    auto& task = package.callable;
+
+    detail::launch(policy, task);
+
+    return std::move(future);
 }
 
 template<typename F, typename... Args>
@@ -725,24 +863,13 @@ auto future<T>::then(thread::id id, std::launch policy, F&& f) -> future<then_re
 {
     detail::check_state(this->state_);
 
-    // invalidate the state
-    auto state = std::move(this->state_);
-    auto package = detail::package_future_task(
-        [f = std::forward<F>(f), state]() mutable
-        {
-            future<T> self(state);
-            return utility::invoke(f, std::move(self));
-        });
-    auto& future = package.callable_future;
-    auto& task = package.callable;
-
-    state->set_continuation(
-        [id, policy, task = std::move(task)]() mutable
-        {
-            detail::launch(id, policy, task);
-        });
+    auto launcher = [id, policy](task& func)
+    {
+        detail::launch(id, policy, func);
+    };
 
-    return std::move(future);
+    // invalidate the state
+    return detail::then_continuation<future<T>>(std::move(this->state_), std::forward<F>(f), launcher);
 }
 
 template<typename T>
@@ -756,15 +883,30 @@ template<typename T>
 template<typename F>
 auto future<T>::then(std::launch policy, F&& f) -> future<then_ret_type<F, future<T>>>
 {
-    thread detached_thread(
-        []()
-        {
-            this_thread::register_this_thread();
-            this_thread::wait();
-            this_thread::unregister_this_thread();
-        });
-    detached_thread.detach();
-    return then(detached_thread.get_id(), policy, std::forward<F>(f));
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // invalidate the state
+    return detail::then_continuation<future<T>>(std::move(this->state_), std::forward<F>(f), launcher);
+}
+
+template<typename T>
+template<typename F>
+auto future<T>::then(launch_inline_t policy, F&& f) -> future<then_ret_type<F, future<T>>>
+{
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // invalidate the state
+    return detail::then_continuation<future<T>>(std::move(this->state_), std::forward<F>(f), launcher);
 }
 
 template<typename T>
@@ -784,24 +926,13 @@ auto shared_future<T>::then(thread::id id, std::launch policy, F&& f) const
 {
     detail::check_state(this->state_);
 
-    // do not invalidate the state
-    auto state = this->state_;
-    auto package = detail::package_future_task(
-        [f = std::forward<F>(f), state]() mutable
-        {
-            shared_future<T> self(state);
-            return utility::invoke(f, std::move(self));
-        });
-    auto& future = package.callable_future;
-    auto& task = package.callable;
-
-    state->set_continuation(
-        [id, policy, task = std::move(task)]() mutable
-        {
-            detail::launch(id, policy, task);
-        });
+    auto launcher = [id, policy](task& func)
+    {
+        detail::launch(id, policy, func);
+    };
 
-    return std::move(future);
+    // do not invalidate the state
+    return detail::then_continuation<shared_future<T>>(this->state_, std::forward<F>(f), launcher);
 }
 
 template<typename T>
@@ -815,15 +946,30 @@ template<typename T>
 template<typename F>
 auto shared_future<T>::then(std::launch policy, F&& f) const -> future<then_ret_type<F, shared_future<T>>>
 {
-    thread detached_thread(
-        []()
-        {
-            this_thread::register_this_thread();
-            this_thread::wait();
-            this_thread::unregister_this_thread();
-        });
-    detached_thread.detach();
-    return then(detached_thread.get_id(), policy, std::forward<F>(f));
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // do not invalidate the state
+    return detail::then_continuation<shared_future<T>>(this->state_, std::forward<F>(f), launcher);
+}
+
+template<typename T>
+template<typename F>
+auto shared_future<T>::then(launch_inline_t policy, F&& f) const -> future<then_ret_type<F, shared_future<T>>>
+{
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // do not invalidate the state
+    return detail::then_continuation<shared_future<T>>(this->state_, std::forward<F>(f), launcher);
 }
 
 template<typename T>
@@ -841,24 +987,13 @@ auto future<void>::then(thread::id id, std::launch policy, F&& f) -> future<then
 {
     detail::check_state(this->state_);
 
-    // invalidate the state
-    auto state = std::move(this->state_);
-    auto package = detail::package_future_task(
-        [f = std::forward<F>(f), state]() mutable
-        {
-            future<void> self(state);
-            utility::invoke(f, std::move(self));
-        });
-    auto& future = package.callable_future;
-    auto& task = package.callable;
-
-    state->set_continuation(
-        [id, policy, task = std::move(task)]() mutable
-        {
-            detail::launch(id, policy, task);
-        });
+    auto launcher = [id, policy](task& func)
+    {
+        detail::launch(id, policy, func);
+    };
 
-    return std::move(future);
+    // invalidate the state
+    return detail::then_continuation<future<void>>(std::move(this->state_), std::forward<F>(f), launcher);
 }
 
 template<typename F>
@@ -870,15 +1005,29 @@ auto future<void>::then(thread::id id, F&& f) -> future<then_ret_type<F, future<
 template<typename F>
 auto future<void>::then(std::launch policy, F&& f) -> future<then_ret_type<F, future<void>>>
 {
-    thread detached_thread(
-        []()
-        {
-            this_thread::register_this_thread();
-            this_thread::wait();
-            this_thread::unregister_this_thread();
-        });
-    detached_thread.detach();
-    return then(detached_thread.get_id(), policy, std::forward<F>(f));
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // invalidate the state
+    return detail::then_continuation<future<void>>(std::move(this->state_), std::forward<F>(f), launcher);
+}
+
+template<typename F>
+auto future<void>::then(launch_inline_t policy, F&& f) -> future<then_ret_type<F, future<void>>>
+{
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // invalidate the state
+    return detail::then_continuation<future<void>>(std::move(this->state_), std::forward<F>(f), launcher);
 }
 
 template<typename F>
@@ -896,24 +1045,13 @@ auto shared_future<void>::then(thread::id id, std::launch policy, F&& f) const
 {
     detail::check_state(this->state_);
 
-    // do not invalidate the state
-    auto state = this->state_;
-    auto package = detail::package_future_task(
-        [f = std::forward<F>(f), state]() mutable
-        {
-            shared_future<void> self(state);
-            utility::invoke(f, std::move(self));
-        });
-    auto& future = package.callable_future;
-    auto& task = package.callable;
-
-    state->set_continuation(
-        [id, policy, task = std::move(task)]() mutable
-        {
-            detail::launch(id, policy, task);
-        });
+    auto launcher = [id, policy](task& func)
+    {
+        detail::launch(id, policy, func);
+    };
 
-    return std::move(future);
+    // do not invalidate the state
+    return detail::then_continuation<shared_future<void>>(this->state_, std::forward<F>(f), launcher);
 }
 
 template<typename F>
@@ -925,15 +1063,29 @@ auto shared_future<void>::then(thread::id id, F&& f) const -> future<then_ret_ty
 template<typename F>
 auto shared_future<void>::then(std::launch policy, F&& f) const -> future<then_ret_type<F, shared_future<void>>>
 {
-    thread detached_thread(
-        []()
-        {
-            this_thread::register_this_thread();
-            this_thread::wait();
-            this_thread::unregister_this_thread();
-        });
-    detached_thread.detach();
-    return then(detached_thread.get_id(), policy, std::forward<F>(f));
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // do not invalidate the state
+    return detail::then_continuation<shared_future<void>>(this->state_, std::forward<F>(f), launcher);
+}
+
+template<typename F>
+auto shared_future<void>::then(launch_inline_t policy, F&& f) const -> future<then_ret_type<F, shared_future<void>>>
+{
+    detail::check_state(this->state_);
+
+    auto launcher = [policy](task& func)
+    {
+        detail::launch(policy, func);
+    };
+
+    // do not invalidate the state
+    return detail::then_continuation<shared_future<void>>(this->state_, std::forward<F>(f), launcher);
 }
 
 template<typename F>
@@ -0,0 +1,323 @@
+#pragma once
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <type_traits>
+
+namespace tpp
+{
+
+//-----------------------------------------------------------------------------
+/// Calls f for every index in [first, last) or every element of the
+/// random access range [first, last) using the pool's workers.
+/// The range is split into chunks of 'grain' elements which are claimed
+/// dynamically by the workers and by the calling thread, which participates
+/// instead of just blocking. A grain of 0 picks one automatically.
+/// The first exception thrown by f is rethrown once all chunks are done.
+//-----------------------------------------------------------------------------
+template<typename It, typename F>
+void parallel_for(thread_pool& pool, It first, It last, std::size_t grain, F&& f);
+template<typename It, typename F>
+void parallel_for(thread_pool& pool, It first, It last, F&& f);
+
+//-----------------------------------------------------------------------------
+/// Reduces the random access range [first, last) with init using op.
+/// Like std::reduce the op must be associative and commutative as
+/// the partial results are combined in no particular order.
+//-----------------------------------------------------------------------------
+template<typename It, typename T, typename BinaryOp>
+auto parallel_reduce(thread_pool& pool, It first, It last, T init, BinaryOp op) -> T;
+template<typename It, typename T>
+auto parallel_reduce(thread_pool& pool, It first, It last, T init) -> T;
+
+//-----------------------------------------------------------------------------
+/// Applies f to every element of the random access range [first, last)
+/// and stores the results starting at d_first.
+/// Returns the output iterator past the last written element.
+//-----------------------------------------------------------------------------
+template<typename It, typename OutIt, typename F>
+auto parallel_transform(thread_pool& pool, It first, It last, OutIt d_first, F&& f) -> OutIt;
+
+//-----------------------------------------------------------------------------
+/// Sorts the random access range [first, last). Blocks are sorted in
+/// parallel and then merged pairwise in parallel rounds. Not stable.
+//-----------------------------------------------------------------------------
+template<typename It, typename Compare>
+void parallel_sort(thread_pool& pool, It first, It last, Compare comp);
+template<typename It>
+void parallel_sort(thread_pool& pool, It first, It last);
+
+//-----------------------------------------------------------------------------
+/// IMPLEMENTATION
+//-----------------------------------------------------------------------------
+namespace detail
+{
+
+struct parallel_state
+{
+    explicit parallel_state(std::size_t chunks_count) : chunks(chunks_count), remaining(chunks_count)
+    {
+    }
+
+    const std::size_t chunks;
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> remaining;
+    std::atomic<bool> failed{false};
+
+    std::mutex error_guard;
+    std::exception_ptr error;
+
+    promise<void> done;
+};
+
+//-----------------------------------------------------------------------------
+/// Claims and runs chunks until none are left. A participant which starts
+/// after all chunks were claimed never touches the body, so the body only
+/// needs to outlive the completion of the chunks.
+//-----------------------------------------------------------------------------
+template<typename F>
+void run_chunks(parallel_state& state, F& body)
+{
+    while(true)
+    {
+        auto chunk = state.next.fetch_add(1, std::memory_order_relaxed);
+        if(chunk >= state.chunks)
+        {
+            return;
+        }
+
+        // after a failure the rest of the chunks are only counted
+        if(!state.failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                body(chunk);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(state.error_guard);
+                if(!state.error)
+                {
+                    state.error = std::current_exception();
+                }
+                state.failed = true;
+            }
+        }
+
+        if(state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            state.done.set_value();
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+/// Runs body(chunk) for every chunk in [0, chunks) on the pool's workers
+/// and the calling thread. Only as many helper jobs as there are workers
+/// are scheduled, not one per chunk.
+//-----------------------------------------------------------------------------
+template<typename F>
+void parallel_chunks(thread_pool& pool, std::size_t chunks, F& body)
+{
+    if(chunks == 0)
+    {
+        return;
+    }
+
+    auto state = std::make_shared<parallel_state>(chunks);
+    auto done = state->done.get_future();
+
+    auto helpers = std::min(pool.get_workers_count(), chunks - 1);
+    for(std::size_t i = 0; i < helpers; ++i)
+    {
+        pool.schedule(
+            [state, &body]()
+            {
+                run_chunks(*state, body);
+            });
+    }
+
+    run_chunks(*state, body);
+    done.wait();
+
+    if(state->error)
+    {
+        std::rethrow_exception(state->error);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/// Picks the chunk size. With an automatic grain each participant gets a
+/// few chunks so that uneven work can still be balanced.
+//-----------------------------------------------------------------------------
+inline auto get_chunk_size(const thread_pool& pool, std::size_t count, std::size_t grain) -> std::size_t
+{
+    if(grain == 0)
+    {
+        const std::size_t chunks_per_participant = 4;
+        auto participants = pool.get_workers_count() + 1;
+        auto chunks = participants * chunks_per_participant;
+        grain = (count + chunks - 1) / chunks;
+    }
+    return std::max<std::size_t>(grain, 1);
+}
+
+template<typename It>
+auto get_distance(It first, It last, std::true_type /*is_integral*/) -> std::size_t
+{
+    return first < last ? static_cast<std::size_t>(last - first) : 0;
+}
+
+template<typename It>
+auto get_distance(It first, It last, std::false_type /*is_integral*/) -> std::size_t
+{
+    auto distance = std::distance(first, last);
+    return distance > 0 ? static_cast<std::size_t>(distance) : 0;
+}
+
+template<typename It, typename F>
+void call_at(It first, std::size_t i, F& f, std::true_type /*is_integral*/)
+{
+    f(static_cast<It>(first + static_cast<It>(i)));
+}
+
+template<typename It, typename F>
+void call_at(It first, std::size_t i, F& f, std::false_type /*is_integral*/)
+{
+    f(first[static_cast<typename std::iterator_traits<It>::difference_type>(i)]);
+}
+
+} // namespace detail
+
+template<typename It, typename F>
+void parallel_for(thread_pool& pool, It first, It last, std::size_t grain, F&& f)
+{
+    using is_integral = std::is_integral<It>;
+
+    auto count = detail::get_distance(first, last, is_integral{});
+    auto chunk_size = detail::get_chunk_size(pool, count, grain);
+    auto chunks = (count + chunk_size - 1) / chunk_size;
+
+    auto body = [&](std::size_t chunk)
+    {
+        auto begin = chunk * chunk_size;
+        auto end = std::min(begin + chunk_size, count);
+        for(auto i = begin; i < end; ++i)
+        {
+            detail::call_at(first, i, f, is_integral{});
+        }
+    };
+    detail::parallel_chunks(pool, chunks, body);
+}
+
+template<typename It, typename F>
+void parallel_for(thread_pool& pool, It first, It last, F&& f)
+{
+    parallel_for(pool, first, last, 0, std::forward<F>(f));
+}
+
+template<typename It, typename T, typename BinaryOp>
+auto parallel_reduce(thread_pool& pool, It first, It last, T init, BinaryOp op) -> T
+{
+    auto count = detail::get_distance(first, last, std::false_type{});
+    auto chunk_size = detail::get_chunk_size(pool, count, 0);
+    auto chunks = (count + chunk_size - 1) / chunk_size;
+
+    std::mutex result_guard;
+    T result = std::move(init);
+
+    auto body = [&](std::size_t chunk)
+    {
+        auto begin = first + static_cast<typename std::iterator_traits<It>::difference_type>(chunk * chunk_size);
+        auto end = first + static_cast<typename std::iterator_traits<It>::difference_type>(
+                               std::min((chunk + 1) * chunk_size, count));
+
+        T partial = *begin;
+        for(++begin; begin != end; ++begin)
+        {
+            partial = op(std::move(partial), *begin);
+        }
+
+        std::lock_guard<std::mutex> lock(result_guard);
+        result = op(std::move(result), std::move(partial));
+    };
+    detail::parallel_chunks(pool, chunks, body);
+
+    return result;
+}
+
+template<typename It, typename T>
+auto parallel_reduce(thread_pool& pool, It first, It last, T init) -> T
+{
+    return parallel_reduce(pool, first, last, std::move(init), std::plus<>());
+}
+
+template<typename It, typename OutIt, typename F>
+auto parallel_transform(thread_pool& pool, It first, It last, OutIt d_first, F&& f) -> OutIt
+{
+    using difference_type = typename std::iterator_traits<It>::difference_type;
+
+    auto count = detail::get_distance(first, last, std::false_type{});
+    parallel_for(pool,
+                 std::size_t(0),
+                 count,
+                 0,
+                 [&](std::size_t i)
+                 {
+                     auto offset = static_cast<difference_type>(i);
+                     d_first[offset] = f(first[offset]);
+                 });
+
+    return d_first + static_cast<difference_type>(count);
+}
+
+template<typename It, typename Compare>
+void parallel_sort(thread_pool& pool, It first, It last, Compare comp)
+{
+    using difference_type = typename std::iterator_traits<It>::difference_type;
+
+    auto count = detail::get_distance(first, last, std::false_type{});
+    if(count < 2)
+    {
+        return;
+    }
+
+    // one block per participant, merged pairwise afterwards
+    auto participants = pool.get_workers_count() + 1;
+    auto block_size = std::max<std::size_t>((count + participants - 1) / participants, 1);
+    auto at = [&](std::size_t i)
+    {
+        return first + static_cast<difference_type>(std::min(i, count));
+    };
+
+    auto blocks = (count + block_size - 1) / block_size;
+    auto sort_block = [&](std::size_t block)
+    {
+        std::sort(at(block * block_size), at((block + 1) * block_size), comp);
+    };
+    detail::parallel_chunks(pool, blocks, sort_block);
+
+    for(auto width = block_size; width < count; width *= 2)
+    {
+        auto pairs = (count + 2 * width - 1) / (2 * width);
+        auto merge_pair = [&](std::size_t pair)
+        {
+            auto begin = pair * 2 * width;
+            std::inplace_merge(at(begin), at(begin + width), at(begin + 2 * width), comp);
+        };
+        detail::parallel_chunks(pool, pairs, merge_pair);
+    }
+}
+
+template<typename It>
+void parallel_sort(thread_pool& pool, It first, It last)
+{
+    parallel_sort(pool, first, last, std::less<>());
+}
+
+} // namespace tpp
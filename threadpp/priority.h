@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+
+namespace tpp
+{
+
+namespace priority
+{
+
+enum class category : size_t
+{
+    normal,
+    high,
+    critical
+};
+
+constexpr size_t categories_count = size_t(category::critical) + 1;
+
+struct group
+{
+    group() = default;
+    group(category c, size_t pr) : level(c), priority(pr)
+    {
+    }
+
+    category level = category::normal;
+    size_t priority = 0;
+};
+
+inline auto operator==(const group& lhs, const group& rhs) -> bool
+{
+    return lhs.level == rhs.level && lhs.priority == rhs.priority;
+}
+
+inline auto normal(size_t priority = 0) -> group
+{
+    return {category::normal, priority};
+}
+inline auto high(size_t priority = 0) -> group
+{
+    return {category::high, priority};
+}
+inline auto critical(size_t priority = 0) -> group
+{
+    return {category::critical, priority};
+}
+
+} // namespace priority
+} // namespace tpp
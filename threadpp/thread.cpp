@@ -1,6 +1,12 @@
 #include "thread.h"
+#include "detail/parking_lot.h"
+#include "detail/task_queue.h"
+#include "detail/timer_wheel.h"
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
@@ -13,31 +19,94 @@ struct thread_context
 {
     std::atomic<thread::id> id{invalid_id()};
     std::atomic<std::thread::id> native_thread_id;
-    std::mutex tasks_mutex;
-    std::vector<task> tasks;
-
-    std::vector<task> processing_tasks;
-    std::size_t processing_idx{0};
-    std::size_t capacity_shrink_threashold{0};
-
+    // number of producers currently holding this context resolved
+    std::atomic<std::uint32_t> pins{0};
+    detail::task_queue tasks;
+    // lanes for priority::category::high and above, indexed by level - 1
+    std::array<detail::task_queue, priority::categories_count - 1> urgent_tasks;
+    // number of tasks in the urgent lanes, so that draining
+    // the normal lane only costs a single load
+    std::atomic<std::uint32_t> urgent_pending{0};
+    // owned by the consumer and fed by the stacks below from other threads
+    detail::timer_wheel timers;
+    std::atomic<detail::timer_node*> scheduled_timers{nullptr};
+    std::atomic<detail::timer_node*> cancelled_timers{nullptr};
+
+    // capacity of each lane, 0 for unbounded
+    std::atomic<std::size_t> max_tasks{0};
+    std::atomic<overflow_policy> overflow{overflow_policy::block};
+    std::atomic<std::uint32_t> blocked_producers{0};
+    // set by the consumer while producers may evict from its lanes.
+    // It then only pops under the mutex.
+    bool evicting{false};
+    std::mutex evict_mutex;
+
+    std::mutex wakeup_mutex;
     std::condition_variable wakeup_event;
     std::atomic<std::uint32_t> processing_stack_depth{0};
 
     std::string name;
-    std::atomic<bool> wakeup{false};
+    // set while the consumer is parked (or about to park) on wakeup_event
+    std::atomic<bool> sleeping{false};
+    // wakes up a parked consumer without giving it a task
+    std::atomic<bool> unparked{false};
     std::atomic<bool> exit{false};
 };
 
+// Contexts live in slots which are never freed, so a thread::id can be
+// resolved to its context without taking the registry mutex.
+// The low bits of an id hold the slot index and the high bits a unique
+// serial, so a stale id never matches a recycled slot.
+constexpr std::size_t slot_bits = 16;
+constexpr std::size_t max_slots = std::size_t(1) << slot_bits;
+constexpr std::size_t slots_per_chunk = 64;
+constexpr std::size_t max_chunks = max_slots / slots_per_chunk;
+
+struct context_chunk
+{
+    std::array<thread_context, slots_per_chunk> slots;
+};
+
+// State of the default executor behind the id-less async/then.
+// Idle threads wait on their own mailbox so that handing them
+// a task is a plain invoke.
+struct executor_context
+{
+    std::mutex mutex;
+    executor_config config;
+    std::vector<thread::id> idle_threads;
+    // the task handed to an executor thread picked from idle_threads,
+    // until the thread takes it. It stays off the idle list meanwhile
+    std::unordered_map<thread::id, task> handed_tasks;
+    std::deque<task> backlog;
+    std::size_t threads_count{0};
+};
+
 struct program_context
 {
+    program_context() = default;
+    program_context(const program_context&) = delete;
+    auto operator=(const program_context&) -> program_context& = delete;
+    ~program_context()
+    {
+        for(auto& chunk : chunks)
+        {
+            delete chunk.load();
+        }
+    }
+
     std::atomic<thread::id> id_generator{};
     std::condition_variable cleanup_event;
     std::mutex mutex;
     std::unordered_map<std::thread::id, thread::id> id_map;
-    std::unordered_map<thread::id, std::shared_ptr<thread_context>> contexts;
+    std::array<std::atomic<context_chunk*>, max_chunks> chunks{};
+    std::vector<std::size_t> free_slots;
+    std::size_t used_slots{0};
+    std::size_t registered_count{0};
     thread::id main_thread_id{invalid_id()};
     std::atomic<size_t> init_count{0};
     init_data config;
+    executor_context executor;
 };
 
 #define log_info_func(msg)  log_info("[tpp::" + std::string(__func__) + "] : " + (msg))
@@ -46,6 +115,7 @@ namespace
 {
 program_context global_data;
 thread_local thread_context* local_data = nullptr;
+thread_local detail::wait_helper* local_wait_helper = nullptr;
 } // namespace
 
 auto get_global_context() -> program_context&
@@ -65,6 +135,382 @@ auto get_local_context() -> thread_context&
     return *local_data;
 }
 
+auto get_slot(thread::id id) -> std::size_t
+{
+    return static_cast<std::size_t>(id & (max_slots - 1));
+}
+
+auto get_slot_context(std::size_t slot) -> thread_context*
+{
+    auto& global_context = get_global_context();
+    auto chunk = global_context.chunks[slot / slots_per_chunk].load(std::memory_order_acquire);
+    if(chunk == nullptr)
+    {
+        return nullptr;
+    }
+    return &chunk->slots[slot % slots_per_chunk];
+}
+
+auto has_pending_work(const thread_context& context) -> bool
+{
+    return context.exit || context.unparked || !context.tasks.empty() || context.urgent_pending != 0 ||
+           context.scheduled_timers != nullptr;
+}
+
+//-----------------------------------------------------------------------------
+/// Lock free stacks through which other threads hand timers to the consumer.
+//-----------------------------------------------------------------------------
+void push_scheduled_timer(thread_context& context, detail::timer_node* node)
+{
+    auto top = context.scheduled_timers.load(std::memory_order_relaxed);
+    do
+    {
+        node->next_scheduled = top;
+        // sequentially consistent so that it orders
+        // against the consumer's sleeping flag
+    } while(!context.scheduled_timers.compare_exchange_weak(top, node, std::memory_order_seq_cst));
+}
+
+void push_cancelled_timer(thread_context& context, detail::timer_node* node)
+{
+    auto top = context.cancelled_timers.load(std::memory_order_relaxed);
+    do
+    {
+        node->next_cancelled = top;
+    } while(!context.cancelled_timers.compare_exchange_weak(top, node, std::memory_order_release));
+}
+
+//-----------------------------------------------------------------------------
+/// Releases the consumer's reference to a timer which will not run again.
+/// The callable is destroyed here so that it never outlives its thread.
+//-----------------------------------------------------------------------------
+void drop_timer(detail::timer_node* node) noexcept
+{
+    node->callable = nullptr;
+    detail::release_ref(node);
+}
+
+struct timer_dropper
+{
+    void operator()(detail::timer_node* node) const noexcept
+    {
+        drop_timer(node);
+    }
+};
+using timer_ptr = std::unique_ptr<detail::timer_node, timer_dropper>;
+
+//-----------------------------------------------------------------------------
+/// Moves the timers scheduled by other threads into the wheel and
+/// unlinks the ones cancelled since the last call.
+//-----------------------------------------------------------------------------
+void collect_timers(thread_context& context)
+{
+    auto scheduled = context.scheduled_timers.exchange(nullptr, std::memory_order_acquire);
+
+    // restore the scheduling order
+    detail::timer_node* ordered = nullptr;
+    while(scheduled != nullptr)
+    {
+        auto next = scheduled->next_scheduled;
+        scheduled->next_scheduled = ordered;
+        ordered = scheduled;
+        scheduled = next;
+    }
+
+    while(ordered != nullptr)
+    {
+        auto next = ordered->next_scheduled;
+        if(ordered->state.load(std::memory_order_acquire) == detail::timer_state::scheduled)
+        {
+            context.timers.insert(ordered);
+        }
+        else
+        {
+            drop_timer(ordered);
+        }
+        ordered = next;
+    }
+
+    auto cancelled = context.cancelled_timers.exchange(nullptr, std::memory_order_acquire);
+    while(cancelled != nullptr)
+    {
+        auto next = cancelled->next_cancelled;
+        if(cancelled->linked)
+        {
+            context.timers.remove(cancelled);
+            drop_timer(cancelled);
+        }
+        detail::release_ref(cancelled);
+        cancelled = next;
+    }
+}
+
+auto has_timers(thread_context& context) -> bool
+{
+    if(context.scheduled_timers.load(std::memory_order_relaxed) != nullptr ||
+       context.cancelled_timers.load(std::memory_order_relaxed) != nullptr)
+    {
+        collect_timers(context);
+    }
+    return !context.timers.empty();
+}
+
+//-----------------------------------------------------------------------------
+/// Runs one timer whose deadline has passed. A repeating timer is
+/// scheduled again unless it was cancelled while running.
+//-----------------------------------------------------------------------------
+auto run_due_timer(thread_context& context) -> bool
+{
+    if(!has_timers(context))
+    {
+        return false;
+    }
+
+    timer_ptr node(context.timers.pop_due(clock::now()));
+    if(!node)
+    {
+        return false;
+    }
+
+    if(node->period == clock::duration::zero())
+    {
+        auto expected = detail::timer_state::scheduled;
+        if(node->state.compare_exchange_strong(expected, detail::timer_state::fired, std::memory_order_acq_rel))
+        {
+            node->callable();
+        }
+        return true;
+    }
+
+    if(node->state.load(std::memory_order_acquire) != detail::timer_state::scheduled)
+    {
+        return true;
+    }
+
+    node->callable();
+
+    if(node->state.load(std::memory_order_acquire) == detail::timer_state::scheduled)
+    {
+        // skip the runs that were missed
+        auto now = clock::now();
+        auto deadline = node->deadline + node->period;
+        if(deadline <= now)
+        {
+            deadline += node->period * ((now - deadline) / node->period + 1);
+        }
+        node->deadline = deadline;
+        context.timers.insert(node.release());
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Drops every timer of an unregistering thread, handing
+/// their callables to be destroyed by the caller.
+//-----------------------------------------------------------------------------
+void clear_timers(thread_context& context, std::vector<task>& callables)
+{
+    collect_timers(context);
+    context.timers.clear(
+        [&](detail::timer_node* node)
+        {
+            auto expected = detail::timer_state::scheduled;
+            node->state.compare_exchange_strong(expected, detail::timer_state::cancelled, std::memory_order_acq_rel);
+            callables.emplace_back(std::move(node->callable));
+            detail::release_ref(node);
+        });
+}
+
+//-----------------------------------------------------------------------------
+/// Wakes up the consumer only if it is parked. The sleeping flag is
+/// consumed so that a burst of producers signals at most once per park.
+//-----------------------------------------------------------------------------
+void wake_up(thread_context& context)
+{
+    // pairs with the sleeping store and the pending work check in park_until
+    if(!context.sleeping.exchange(false, std::memory_order_seq_cst))
+    {
+        return;
+    }
+
+    // the consumer holds the mutex from its last check until it waits,
+    // so once we get it the notification can no longer be missed
+    {
+        std::lock_guard<std::mutex> lock(context.wakeup_mutex);
+    }
+    context.wakeup_event.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+/// Parks the consumer until there is pending work or the deadline passes.
+/// Producers only signal when they observe the sleeping flag, so a consumer
+/// that is busy processing costs them no syscalls.
+//-----------------------------------------------------------------------------
+auto park_until(thread_context& context, const clock::time_point& deadline) -> std::cv_status
+{
+    auto status = std::cv_status::no_timeout;
+
+    std::unique_lock<std::mutex> lock(context.wakeup_mutex);
+
+    // announce the intent to sleep before the last check so that a
+    // concurrent push either sees the flag or is seen by the check
+    context.sleeping.store(true, std::memory_order_seq_cst);
+    while(!has_pending_work(context))
+    {
+        if(context.wakeup_event.wait_until(lock, deadline) == std::cv_status::timeout)
+        {
+            if(!has_pending_work(context))
+            {
+                status = std::cv_status::timeout;
+            }
+            break;
+        }
+        context.sleeping.store(true, std::memory_order_seq_cst);
+    }
+    context.sleeping.store(false, std::memory_order_relaxed);
+    context.unparked.store(false, std::memory_order_relaxed);
+
+    return status;
+}
+
+void park(thread_context& context)
+{
+    std::unique_lock<std::mutex> lock(context.wakeup_mutex);
+
+    context.sleeping.store(true, std::memory_order_seq_cst);
+    while(!has_pending_work(context))
+    {
+        context.wakeup_event.wait(lock);
+        context.sleeping.store(true, std::memory_order_seq_cst);
+    }
+    context.sleeping.store(false, std::memory_order_relaxed);
+    context.unparked.store(false, std::memory_order_relaxed);
+}
+
+auto get_lane(thread_context& context, priority::category level) -> detail::task_queue&
+{
+    if(level == priority::category::normal)
+    {
+        return context.tasks;
+    }
+    return context.urgent_tasks[size_t(level) - 1];
+}
+
+//-----------------------------------------------------------------------------
+/// Wakes up the producers waiting for room in a lane.
+//-----------------------------------------------------------------------------
+void wake_blocked_producers(thread_context& context, const detail::task_queue& lane)
+{
+    // a read-modify-write so that either it sees the increment in
+    // wait_for_room or that waiter sees the room made before this call
+    if(context.blocked_producers.fetch_add(0, std::memory_order_acq_rel) != 0)
+    {
+        detail::parking_lot::unpark_all(&lane);
+    }
+}
+
+void wake_blocked_producers(thread_context& context)
+{
+    wake_blocked_producers(context, context.tasks);
+    for(const auto& lane : context.urgent_tasks)
+    {
+        wake_blocked_producers(context, lane);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/// Applies a capacity configuration. Must be called by the consumer or
+/// before it starts, as switching to evicting changes how it pops.
+//-----------------------------------------------------------------------------
+void apply_tasks_capacity(thread_context& context, const tasks_capacity_config& config)
+{
+    {
+        // evicting producers pop and so recycle into the pools as well
+        std::lock_guard<std::mutex> lock(context.evict_mutex);
+        context.evicting = config.max_tasks != 0 && config.overflow == overflow_policy::drop_oldest;
+
+        context.tasks.set_pool_size(config.default_reserved_tasks, config.capacity_shrink_threashold);
+        for(auto& lane : context.urgent_tasks)
+        {
+            lane.set_pool_size(0, config.capacity_shrink_threashold);
+        }
+    }
+    context.max_tasks = config.max_tasks;
+    context.overflow = config.overflow;
+
+    // a larger capacity or another policy may let them through
+    wake_blocked_producers(context);
+}
+
+//-----------------------------------------------------------------------------
+/// Resolves an id to its context without locking and pins it.
+/// While pinned the context will not be recycled by unregister_thread_impl.
+//-----------------------------------------------------------------------------
+class pinned_context
+{
+public:
+    explicit pinned_context(thread::id id)
+    {
+        if(id == invalid_id())
+        {
+            return;
+        }
+
+        pin(get_slot_context(get_slot(id)), id);
+    }
+
+    explicit pinned_context(const thread_handle& handle)
+    {
+        pin(handle.context_, handle.id_);
+    }
+
+    pinned_context(const pinned_context&) = delete;
+    auto operator=(const pinned_context&) -> pinned_context& = delete;
+
+    ~pinned_context()
+    {
+        if(context_ != nullptr)
+        {
+            context_->pins.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    explicit operator bool() const
+    {
+        return context_ != nullptr;
+    }
+
+    auto operator->() const -> thread_context*
+    {
+        return context_;
+    }
+
+    auto get() const -> thread_context*
+    {
+        return context_;
+    }
+
+private:
+    void pin(thread_context* context, thread::id id)
+    {
+        if(context == nullptr)
+        {
+            return;
+        }
+
+        // pairs with the id reset and the pins check in unregister_thread_impl
+        context->pins.fetch_add(1, std::memory_order_seq_cst);
+        if(context->id.load(std::memory_order_seq_cst) != id)
+        {
+            context->pins.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        context_ = context;
+    }
+
+    thread_context* context_{};
+};
+
 void name_thread(const std::string& name)
 {
     const auto& global_context = get_global_context();
@@ -101,287 +547,977 @@ void log_error(const std::string& name)
     }
 }
 
-auto register_thread_impl(std::thread::id native_thread_id, const std::string& name) -> std::shared_ptr<thread_context>
+auto register_thread_impl(std::thread::id native_thread_id, const std::string& name) -> thread_context*
 {
     auto& global_context = get_global_context();
     std::unique_lock<std::mutex> lock(global_context.mutex);
-    auto id = [&]()
+
+    auto tidit = global_context.id_map.find(native_thread_id);
+    if(tidit != global_context.id_map.end())
+    {
+        return get_slot_context(get_slot(tidit->second));
+    }
+
+    std::size_t slot = 0;
+    if(!global_context.free_slots.empty())
+    {
+        slot = global_context.free_slots.back();
+        global_context.free_slots.pop_back();
+    }
+    else if(global_context.used_slots < max_slots)
+    {
+        slot = global_context.used_slots++;
+    }
+    else
+    {
+        log_error_func("Maximum number of registered threads reached.");
+        return nullptr;
+    }
+
+    auto& chunk = global_context.chunks[slot / slots_per_chunk];
+    if(chunk.load(std::memory_order_relaxed) == nullptr)
+    {
+        chunk.store(new context_chunk(), std::memory_order_release);
+    }
+
+    auto local_context = get_slot_context(slot);
+    local_context->processing_stack_depth = 0;
+    local_context->native_thread_id = native_thread_id;
+    apply_tasks_capacity(*local_context, global_context.config.tasks_capacity);
+    local_context->name = name;
+    local_context->sleeping = false;
+    local_context->unparked = false;
+    local_context->exit = false;
+
+    // publishing the id makes the context resolvable
+    auto id = (++global_context.id_generator << slot_bits) | slot;
+    local_context->id.store(id, std::memory_order_release);
+
+    global_context.id_map[native_thread_id] = id;
+    global_context.registered_count++;
+
+    return local_context;
+}
+
+void unregister_thread_impl(thread::id id)
+{
+    // unlock of global mutex must happen before
+    // destructor of the pending tasks
+    std::vector<task> pending_tasks;
+    auto& global_context = get_global_context();
+    std::lock_guard<std::mutex> lock(global_context.mutex);
+    auto context = id == invalid_id() ? nullptr : get_slot_context(get_slot(id));
+    if(context == nullptr || context->id != id)
+    {
+        return;
+    }
+
+    // stop new lookups from resolving this context and
+    // wait for the ones that already did
+    context->id.store(invalid_id(), std::memory_order_seq_cst);
+    wake_blocked_producers(*context);
+    while(context->pins.load(std::memory_order_seq_cst) != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    // no producers are left so the queues can be drained
+    auto drain = [&](detail::task_queue& queue)
     {
-        auto tidit = global_context.id_map.find(native_thread_id);
-        if(tidit != global_context.id_map.end())
+        task callable;
+        while(queue.pop(callable))
         {
-            return tidit->second;
+            pending_tasks.emplace_back(std::move(callable));
         }
-        return invalid_id();
-    }();
+    };
+    for(auto it = context->urgent_tasks.rbegin(); it != context->urgent_tasks.rend(); ++it)
+    {
+        drain(*it);
+    }
+    drain(context->tasks);
+    context->urgent_pending = 0;
+    clear_timers(*context, pending_tasks);
+
+    global_context.id_map.erase(context->native_thread_id);
+    // now the slot can be reused
+    global_context.free_slots.emplace_back(get_slot(id));
+    global_context.registered_count--;
+    // if this was the last entry then
+    // notify that everything is cleaned up
+    if(global_context.registered_count == 0)
+    {
+        global_context.cleanup_event.notify_all();
+    }
+}
+
+namespace
+{
+// Hands the calling executor thread the task handed to it, the next
+// queued task or, if there is none, marks it as idle.
+auto take_executor_task(executor_context& executor, thread::id id, task& f) -> bool
+{
+    std::lock_guard<std::mutex> lock(executor.mutex);
+    auto& handed = executor.handed_tasks[id];
+    if(handed)
+    {
+        f = std::move(handed);
+        handed = nullptr;
+        return true;
+    }
+    if(!executor.backlog.empty())
+    {
+        f = std::move(executor.backlog.front());
+        executor.backlog.pop_front();
+        return true;
+    }
+
+    // a wake up for anything else than a handed task leaves
+    // the thread still listed as idle
+    auto it = std::find(executor.idle_threads.begin(), executor.idle_threads.end(), id);
+    if(it == executor.idle_threads.end())
+    {
+        executor.idle_threads.emplace_back(id);
+    }
+    return false;
+}
+
+// Retires an idle executor thread unless a task was just handed
+// to it or it is needed to keep min_threads alive.
+auto retire_executor_thread(executor_context& executor, thread::id id) -> bool
+{
+    std::lock_guard<std::mutex> lock(executor.mutex);
+    auto it = std::find(executor.idle_threads.begin(), executor.idle_threads.end(), id);
+    if(it == executor.idle_threads.end() || executor.threads_count <= executor.config.min_threads)
+    {
+        return false;
+    }
+    executor.idle_threads.erase(it);
+    executor.handed_tasks.erase(id);
+    executor.threads_count--;
+    return true;
+}
+
+void run_executor_thread(const std::string& name, task first)
+{
+    name_thread(name);
 
+    this_thread::register_this_thread(name);
+
+    on_thread_start(name);
+
+    first();
+    first = nullptr;
+
+    auto& executor = get_global_context().executor;
+    auto id = this_thread::get_id();
+    auto retired = false;
+    while(!this_thread::notified_for_exit())
+    {
+        // runs what is there and lists the thread as idle before it
+        // parks, so that the next task is handed to it
+        task f;
+        while(!this_thread::notified_for_exit() && take_executor_task(executor, id, f))
+        {
+            f();
+            f = nullptr;
+        }
+
+        std::chrono::milliseconds idle_timeout{};
+        {
+            std::lock_guard<std::mutex> lock(executor.mutex);
+            idle_timeout = executor.config.idle_timeout;
+        }
+
+        // a handed task unparks this thread and is taken above
+        if(this_thread::wait_for(idle_timeout) == std::cv_status::timeout && retire_executor_thread(executor, id))
+        {
+            retired = true;
+            break;
+        }
+    }
+
+    // destroyed outside the lock as this breaks its promise
+    task dropped;
+    if(!retired)
+    {
+        std::lock_guard<std::mutex> lock(executor.mutex);
+        auto it = std::find(executor.idle_threads.begin(), executor.idle_threads.end(), id);
+        if(it != executor.idle_threads.end())
+        {
+            executor.idle_threads.erase(it);
+        }
+        auto handed = executor.handed_tasks.find(id);
+        if(handed != executor.handed_tasks.end())
+        {
+            dropped = std::move(handed->second);
+            executor.handed_tasks.erase(handed);
+        }
+        executor.threads_count--;
+    }
+    dropped = nullptr;
+
+    this_thread::unregister_this_thread();
+}
+
+// Drops the tasks nobody is left to run and resets the configuration.
+void clear_default_executor()
+{
+    auto& executor = get_global_context().executor;
+    std::deque<task> backlog;
+    {
+        std::lock_guard<std::mutex> lock(executor.mutex);
+        backlog.swap(executor.backlog);
+        executor.config = {};
+    }
+    // destroyed outside the lock as this breaks their promises
+    // which may run continuations
+}
+} // namespace
+
+void init(const init_data& data)
+{
+    auto& global_context = get_global_context();
+    if(global_context.init_count++ != 0)
+    {
+        return;
+    }
+
+    this_thread::register_this_thread("Main Thread");
+    std::unique_lock<std::mutex> lock(global_context.mutex);
+    global_context.main_thread_id = this_thread::get_id();
+    global_context.config = data;
+    {
+        std::lock_guard<std::mutex> executor_lock(global_context.executor.mutex);
+        global_context.executor.config = data.default_executor;
+    }
+    log_info_func("Successful.");
+}
+
+auto shutdown(const std::chrono::seconds& timeout) -> int
+{
+    auto& global_context = get_global_context();
+    if(global_context.init_count == 0)
+    {
+        log_error_func("Shutting down when not initted.");
+        return -1;
+    }
+
+    if(--global_context.init_count != 0)
+    {
+        return -1;
+    }
+
+    this_thread::unregister_this_thread();
+    log_info_func("Notifying and waiting for threads to complete.");
+    auto all_threads = get_all_registered_threads();
+    for(const auto& id : all_threads)
+    {
+        notify_for_exit(id);
+    }
+    std::unique_lock<std::mutex> lock(global_context.mutex);
+
+    // guard for spurious wakeups
+    auto predicate = [&]() -> bool
+    {
+        return global_context.registered_count == 0;
+    };
+
+    auto result = global_context.cleanup_event.wait_for(lock, timeout, predicate);
+
+    lock.unlock();
+    clear_default_executor();
+    lock.lock();
+
+    if(result)
+    {
+        log_info_func("Successful.");
+        global_context.config = {};
+        return 0;
+    }
+    else
+    {
+        log_info_func("Timed out. Not all registered threads exited.");
+        global_context.config = {};
+        return static_cast<int>(global_context.registered_count);
+    }
+}
+
+auto get_all_registered_threads() -> std::vector<thread::id>
+{
+    std::vector<thread::id> result;
+    auto& global_context = get_global_context();
+    std::unique_lock<std::mutex> lock(global_context.mutex);
+
+    result.reserve(global_context.registered_count);
+    for(std::size_t slot = 0; slot < global_context.used_slots; ++slot)
+    {
+        auto id = get_slot_context(slot)->id.load();
+        if(id != invalid_id())
+        {
+            result.emplace_back(id);
+        }
+    }
+
+    return result;
+}
+
+auto get_pending_task_count_detailed(thread::id id) -> task_info
+{
+    if(id == invalid_id())
+    {
+        log_error_func("Invoking to an invalid thread.");
+        return {};
+    }
+    pinned_context context(id);
+    if(!context)
+    {
+        return {};
+    }
+
+    auto pending = context->tasks.size();
+    auto memory_usage = context->tasks.memory_usage();
+    for(const auto& lane : context->urgent_tasks)
+    {
+        pending += lane.size();
+        memory_usage += lane.memory_usage();
+    }
+    const auto processing = context->processing_stack_depth.load();
+    const auto total = processing + pending;
+
+    task_info info;
+    info.count = total;
+    info.memory_usage = memory_usage;
+    if(!context->name.empty())
+    {
+        info.thread_name = context->name;
+    }
+    else
+    {
+        info.thread_name = std::to_string(id);
+    }
+    return info;
+}
+
+auto get_pending_task_count(thread::id id) -> size_t
+{
+    return get_pending_task_count_detailed(id).count;
+}
+
+void notify_for_exit(thread::id id)
+{
+    pinned_context context(id);
+    if(!context)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> remote_lock(context->wakeup_mutex);
+        context->exit = true;
+    }
+    context->wakeup_event.notify_one();
+}
+
+void notify(thread::id id)
+{
+    dispatch(id,
+           []()
+           {
+           });
+}
+
+
+auto register_thread(std::thread::id id, const std::string& name) -> thread::id
+{
+    auto ctx = register_thread_impl(id, name);
+    if(ctx == nullptr)
+    {
+        return invalid_id();
+    }
+    return ctx->id;
+}
+
+
+auto get_thread_handle(thread::id id) -> thread_handle
+{
+    pinned_context context(id);
+    if(!context)
+    {
+        return {};
+    }
+
+    return {context.get(), id};
+}
+
+thread_handle::thread_handle(thread_context* context, thread::id id) : context_(context), id_(id)
+{
+}
+
+auto thread_handle::get_id() const -> thread::id
+{
+    return id_;
+}
+
+auto thread_handle::expired() const -> bool
+{
+    return context_ == nullptr || context_->id != id_;
+}
+
+timer_handle::timer_handle(detail::timer_node* node) noexcept : node_(node)
+{
+}
+
+timer_handle::timer_handle(const timer_handle& rhs) noexcept : node_(rhs.node_)
+{
+    if(node_ != nullptr)
+    {
+        node_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+timer_handle::timer_handle(timer_handle&& rhs) noexcept : node_(rhs.node_)
+{
+    rhs.node_ = nullptr;
+}
+
+auto timer_handle::operator=(const timer_handle& rhs) noexcept -> timer_handle&
+{
+    timer_handle(rhs).swap(*this);
+    return *this;
+}
+
+auto timer_handle::operator=(timer_handle&& rhs) noexcept -> timer_handle&
+{
+    timer_handle(std::move(rhs)).swap(*this);
+    return *this;
+}
+
+timer_handle::~timer_handle()
+{
+    if(node_ != nullptr)
+    {
+        detail::release_ref(node_);
+    }
+}
+
+void timer_handle::swap(timer_handle& rhs) noexcept
+{
+    std::swap(node_, rhs.node_);
+}
+
+auto timer_handle::cancel() -> bool
+{
+    if(node_ == nullptr)
+    {
+        return false;
+    }
+
+    auto expected = detail::timer_state::scheduled;
+    if(!node_->state.compare_exchange_strong(expected, detail::timer_state::cancelled, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+
+    // let the thread unlink it now rather than at its deadline
+    pinned_context context(node_->owner);
+    if(context)
+    {
+        node_->refs.fetch_add(1, std::memory_order_relaxed);
+        push_cancelled_timer(*context.get(), node_);
+    }
+    return true;
+}
+
+auto timer_handle::expired() const -> bool
+{
+    return node_ == nullptr || node_->state.load(std::memory_order_acquire) != detail::timer_state::scheduled;
+}
+
+namespace detail
+{
+auto push_task(thread_context& context, task& f) -> bool
+{
+    context.tasks.push(f);
+    wake_up(context);
+    return true;
+}
+
+auto push_task(thread_context& context, task& f, priority::category level) -> bool
+{
+    if(level == priority::category::normal)
+    {
+        return push_task(context, f);
+    }
+
+    // counted before the push so that the consumer
+    // never misses a task which is already visible
+    context.urgent_pending++;
+    context.urgent_tasks[size_t(level) - 1].push(f);
+    wake_up(context);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Discards the oldest task of a full lane. Returns false if the consumer
+/// has not switched to evicting yet.
+//-----------------------------------------------------------------------------
+auto evict_oldest(thread_context& context, task_queue& lane, bool urgent, std::vector<task>& evicted) -> bool
+{
+    task oldest;
+    {
+        std::lock_guard<std::mutex> lock(context.evict_mutex);
+        if(!context.evicting)
+        {
+            return false;
+        }
+        if(!lane.pop(oldest))
+        {
+            return true;
+        }
+    }
+
+    if(urgent)
+    {
+        context.urgent_pending--;
+    }
+    // destroyed by the caller once the context is unpinned, as
+    // it may run user code which needs to register or resolve a thread
+    evicted.emplace_back(std::move(oldest));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Blocks until the lane has room or the thread unregisters.
+/// Returns false in the latter case.
+//-----------------------------------------------------------------------------
+auto wait_for_room(thread_context& context, const task_queue& lane) -> bool
+{
+    context.blocked_producers.fetch_add(1, std::memory_order_seq_cst);
+    parking_lot::park(&lane,
+                      [&]()
+                      {
+                          auto capacity = context.max_tasks.load(std::memory_order_seq_cst);
+                          return capacity == 0 || lane.size() < capacity ||
+                                 context.overflow != overflow_policy::block || context.id == invalid_id();
+                      });
+    context.blocked_producers.fetch_sub(1, std::memory_order_relaxed);
+
+    return context.id != invalid_id();
+}
+
+//-----------------------------------------------------------------------------
+/// Pushes a task honoring the capacity of the mailbox. The thread itself
+/// is never blocked nor failed when invoking into its own mailbox, as it
+/// is the only one who could make room.
+//-----------------------------------------------------------------------------
+auto push_bounded_task(thread_context& context,
+                       task& f,
+                       priority::category level,
+                       bool may_block,
+                       std::vector<task>& evicted) -> bool
+{
+    auto capacity = context.max_tasks.load(std::memory_order_relaxed);
+    if(capacity == 0 || (has_local_context() && &get_local_context() == &context))
+    {
+        return push_task(context, f, level);
+    }
+
+    auto& lane = get_lane(context, level);
+    const bool urgent = level != priority::category::normal;
+    while(true)
+    {
+        if(urgent)
+        {
+            context.urgent_pending++;
+        }
+        if(lane.try_push(f, capacity))
+        {
+            wake_up(context);
+            return true;
+        }
+        if(urgent)
+        {
+            context.urgent_pending--;
+        }
+
+        switch(context.overflow.load(std::memory_order_relaxed))
+        {
+            case overflow_policy::fail:
+                return false;
+
+            case overflow_policy::drop_oldest:
+                if(!evict_oldest(context, lane, urgent, evicted))
+                {
+                    // the policy is still being switched to
+                    return push_task(context, f, level);
+                }
+                break;
+
+            case overflow_policy::block:
+                if(!may_block || !wait_for_room(context, lane))
+                {
+                    return false;
+                }
+                break;
+        }
+
+        capacity = context.max_tasks.load(std::memory_order_relaxed);
+        if(capacity == 0)
+        {
+            return push_task(context, f, level);
+        }
+    }
+}
+
+auto push_tasks(thread_context& context, task* tasks, std::size_t count, std::vector<task>& evicted) -> std::size_t
+{
+    if(context.max_tasks.load(std::memory_order_relaxed) != 0)
+    {
+        std::size_t pushed = 0;
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            if(tasks[i] && push_bounded_task(context, tasks[i], priority::category::normal, true, evicted))
+            {
+                ++pushed;
+            }
+        }
+        return pushed;
+    }
+
+    auto pushed = context.tasks.push_bulk(tasks, count);
+    if(pushed > 0)
+    {
+        wake_up(context);
+    }
+    return pushed;
+}
+
+// this function exists to avoid extra moves of the functor
+// via the dispatch
+auto invoke_packaged_task(thread::id id, task& f) -> bool
+{
+    if(f == nullptr)
+    {
+        log_error_func("Invoking an invalid task.");
+        return false;
+    }
+    if(id == invalid_id())
+    {
+        log_error_func("Invoking to an invalid thread.");
+        return false;
+    }
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(id);
+    if(!context)
+    {
+        return false;
+    }
+
+    return push_bounded_task(*context.get(), f, priority::category::normal, true, evicted);
+}
+
+auto invoke_packaged_task(const thread_handle& handle, task& f) -> bool
+{
+    if(f == nullptr)
+    {
+        log_error_func("Invoking an invalid task.");
+        return false;
+    }
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(handle);
+    if(!context)
+    {
+        return false;
+    }
+
+    return push_bounded_task(*context.get(), f, priority::category::normal, true, evicted);
+}
+
+auto invoke_packaged_task(thread::id id, task& f, priority::category level) -> bool
+{
+    if(f == nullptr)
+    {
+        log_error_func("Invoking an invalid task.");
+        return false;
+    }
     if(id == invalid_id())
     {
-        id = ++global_context.id_generator;
+        log_error_func("Invoking to an invalid thread.");
+        return false;
     }
-
-    auto it = global_context.contexts.find(id);
-    if(it != global_context.contexts.end())
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(id);
+    if(!context)
     {
-        return it->second;
+        return false;
     }
 
-    auto local_context = std::make_shared<thread_context>();
-    local_context->tasks.reserve(global_context.config.tasks_capacity.default_reserved_tasks);
-    local_context->native_thread_id = native_thread_id;
-    local_context->id = id;
-    local_context->capacity_shrink_threashold = global_context.config.tasks_capacity.capacity_shrink_threashold;
-
-    local_context->name = name;
-    global_context.id_map[native_thread_id] = id;
-    global_context.contexts.emplace(id, local_context);
-
-    return local_context;
+    return push_bounded_task(*context.get(), f, level, true, evicted);
 }
 
-void unregister_thread_impl(thread::id id)
+auto invoke_packaged_task(const thread_handle& handle, task& f, priority::category level) -> bool
 {
-    // unlock of global mutex must happen before
-    // destructor of context
-    std::shared_ptr<thread_context> context{};
-    auto& global_context = get_global_context();
-    std::lock_guard<std::mutex> lock(global_context.mutex);
-    auto it = global_context.contexts.find(id);
-    if(it == global_context.contexts.end())
+    if(f == nullptr)
     {
-        return;
+        log_error_func("Invoking an invalid task.");
+        return false;
     }
-
-    // get the context and lock it
-    context = it->second;
-    std::lock_guard<std::mutex> local_lock(context->tasks_mutex);
-
-    global_context.id_map.erase(context->native_thread_id);
-    // now we can safely remove the context
-    // from the global container and the local variable
-    // will be the last reference to it
-    global_context.contexts.erase(id);
-    // if this was the last entry then
-    // notify that everything is cleaned up
-    if(global_context.contexts.empty())
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(handle);
+    if(!context)
     {
-        global_context.cleanup_event.notify_all();
+        return false;
     }
+
+    return push_bounded_task(*context.get(), f, level, true, evicted);
 }
 
-void init(const init_data& data)
+auto try_invoke_packaged_task(thread::id id, task& f) -> bool
 {
-    auto& global_context = get_global_context();
-    if(global_context.init_count++ != 0)
+    if(f == nullptr)
     {
-        return;
+        log_error_func("Invoking an invalid task.");
+        return false;
+    }
+    if(id == invalid_id())
+    {
+        log_error_func("Invoking to an invalid thread.");
+        return false;
+    }
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(id);
+    if(!context)
+    {
+        return false;
     }
 
-    this_thread::register_this_thread("Main Thread");
-    std::unique_lock<std::mutex> lock(global_context.mutex);
-    global_context.main_thread_id = this_thread::get_id();
-    global_context.config = data;
-    log_info_func("Successful.");
+    return push_bounded_task(*context.get(), f, priority::category::normal, false, evicted);
 }
 
-auto shutdown(const std::chrono::seconds& timeout) -> int
+auto try_invoke_packaged_task(const thread_handle& handle, task& f) -> bool
 {
-    auto& global_context = get_global_context();
-    if(global_context.init_count == 0)
+    if(f == nullptr)
     {
-        log_error_func("Shutting down when not initted.");
-        return -1;
+        log_error_func("Invoking an invalid task.");
+        return false;
     }
-
-    if(--global_context.init_count != 0)
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(handle);
+    if(!context)
     {
-        return -1;
+        return false;
     }
 
-    this_thread::unregister_this_thread();
-    log_info_func("Notifying and waiting for threads to complete.");
-    auto all_threads = get_all_registered_threads();
-    for(const auto& id : all_threads)
+    return push_bounded_task(*context.get(), f, priority::category::normal, false, evicted);
+}
+
+auto invoke_packaged_tasks(thread::id id, task* tasks, std::size_t count) -> std::size_t
+{
+    if(id == invalid_id())
     {
-        notify_for_exit(id);
+        log_error_func("Invoking to an invalid thread.");
+        return 0;
     }
-    std::unique_lock<std::mutex> lock(global_context.mutex);
-
-    // guard for spurious wakeups
-    auto predicate = [&]() -> bool
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(id);
+    if(!context)
     {
-        return global_context.contexts.empty();
-    };
+        return 0;
+    }
 
-    auto result = global_context.cleanup_event.wait_for(lock, timeout, predicate);
+    return push_tasks(*context.get(), tasks, count, evicted);
+}
 
-    if(result)
+auto invoke_packaged_tasks(const thread_handle& handle, task* tasks, std::size_t count) -> std::size_t
+{
+    // destroyed after the context is unpinned
+    std::vector<task> evicted;
+    pinned_context context(handle);
+    if(!context)
     {
-        log_info_func("Successful.");
-        global_context.config = {};
         return 0;
     }
+
+    return push_tasks(*context.get(), tasks, count, evicted);
+}
+
+auto push_timer(thread_context& context, task& f, clock::time_point deadline, clock::duration period)
+    -> timer_node*
+{
+    auto node = new timer_node();
+    node->callable = std::move(f);
+    node->deadline = deadline;
+    node->period = period;
+    node->owner = context.id;
+    // one reference for the thread and one for the handle
+    node->refs = 2;
+
+    if(has_local_context() && &get_local_context() == &context)
+    {
+        context.timers.insert(node);
+    }
     else
     {
-        log_info_func("Timed out. Not all registered threads exited.");
-        global_context.config = {};
-        return static_cast<int>(global_context.contexts.size());
+        push_scheduled_timer(context, node);
+        wake_up(context);
     }
+    return node;
 }
 
-auto get_all_registered_threads() -> std::vector<thread::id>
+auto check_timer(const task& f, clock::duration period) -> bool
 {
-    std::vector<thread::id> result;
-    auto& global_context = get_global_context();
-    std::unique_lock<std::mutex> lock(global_context.mutex);
-
-    result.reserve(global_context.contexts.size());
-    for(const auto& p : global_context.contexts)
+    if(f == nullptr)
     {
-        result.emplace_back(p.first);
+        log_error_func("Scheduling an invalid task.");
+        return false;
     }
-
-    return result;
+    if(period < clock::duration::zero())
+    {
+        log_error_func("Scheduling a task with a negative period.");
+        return false;
+    }
+    return true;
 }
 
-auto get_pending_task_count_detailed(thread::id id) -> task_info
+auto schedule_packaged_timer(thread::id id, task& f, clock::time_point deadline, clock::duration period)
+    -> timer_handle
 {
+    if(!check_timer(f, period))
+    {
+        return {};
+    }
     if(id == invalid_id())
     {
         log_error_func("Invoking to an invalid thread.");
         return {};
     }
-    auto& global_context = get_global_context();
-    std::unique_lock<std::mutex> lock(global_context.mutex);
-
-    auto it = global_context.contexts.find(id);
-    if(it == global_context.contexts.end())
+    pinned_context context(id);
+    if(!context)
     {
         return {};
     }
 
-    auto context = it->second;
-
-    lock.unlock();
-
-    std::lock_guard<std::mutex> remote_lock(context->tasks_mutex);
-
-    const auto left_to_process = context->processing_tasks.size() - context->processing_idx;
-    const auto pending = context->tasks.size();
-    const auto processing = context->processing_stack_depth.load();
-    const auto total = processing + left_to_process + pending;
+    return timer_handle(push_timer(*context.get(), f, deadline, period));
+}
 
-    task_info info;
-    info.count = total;
-    if(!context->name.empty())
+auto schedule_packaged_timer(const thread_handle& handle,
+                             task& f,
+                             clock::time_point deadline,
+                             clock::duration period) -> timer_handle
+{
+    if(!check_timer(f, period))
     {
-        info.thread_name = context->name;
+        return {};
     }
-    else
+    pinned_context context(handle);
+    if(!context)
     {
-        info.thread_name = std::to_string(id);
+        return {};
     }
-    return info;
+
+    return timer_handle(push_timer(*context.get(), f, deadline, period));
 }
 
-auto get_pending_task_count(thread::id id) -> size_t
+auto check_period(clock::duration period) -> bool
 {
-    return get_pending_task_count_detailed(id).count;
+    if(period <= clock::duration::zero())
+    {
+        log_error_func("Scheduling a periodic task with a period which is not positive.");
+        return false;
+    }
+    return true;
 }
 
-auto has_tasks_to_process(const thread_context& context) -> bool
+auto schedule_packaged_periodic_timer(thread::id id, task& f, clock::duration period) -> timer_handle
 {
-    return context.processing_idx < context.processing_tasks.size();
+    if(!check_period(period))
+    {
+        return {};
+    }
+    return schedule_packaged_timer(id, f, clock::now() + period, period);
 }
 
-auto prepare_tasks(thread_context& context) -> bool
+auto schedule_packaged_periodic_timer(const thread_handle& handle, task& f, clock::duration period) -> timer_handle
 {
-    if(!has_tasks_to_process(context) && !context.tasks.empty())
+    if(!check_period(period))
     {
-        std::swap(context.tasks, context.processing_tasks);
-        context.tasks.clear();
-        if(context.tasks.capacity() > context.capacity_shrink_threashold)
-        {
-            context.tasks.shrink_to_fit();
-        }
-        context.processing_idx = 0;
+        return {};
     }
-
-    return has_tasks_to_process(context);
+    return schedule_packaged_timer(handle, f, clock::now() + period, period);
 }
 
-void notify_for_exit(thread::id id)
+void unpark(thread::id id)
 {
-    auto& global_context = get_global_context();
-    std::unique_lock<std::mutex> lock(global_context.mutex);
-
-    auto it = global_context.contexts.find(id);
-    if(it == global_context.contexts.end())
+    pinned_context context(id);
+    if(!context)
     {
         return;
     }
 
-    auto context = it->second;
-
-    lock.unlock();
-
-    std::lock_guard<std::mutex> remote_lock(context->tasks_mutex);
-
-    context->exit = true;
-    context->wakeup = true;
-    context->wakeup_event.notify_all();
+    context->unparked = true;
+    wake_up(*context.get());
 }
 
-void notify(thread::id id)
+auto exchange_wait_helper(wait_helper* helper) -> wait_helper*
 {
-    dispatch(id,
-           []()
-           {
-           });
+    auto previous = local_wait_helper;
+    local_wait_helper = helper;
+    return previous;
 }
 
-
-auto register_thread(std::thread::id id, const std::string& name) -> thread::id
+auto get_wait_helper() -> wait_helper*
 {
-    auto ctx = register_thread_impl(id, name);
-    return ctx->id;
+    return local_wait_helper;
 }
 
-
-namespace detail
-{
-// this function exists to avoid extra moves of the functor
-// via the dispatch
-auto invoke_packaged_task(thread::id id, task& f) -> bool
+auto invoke_default_executor(task& f) -> bool
 {
     if(f == nullptr)
     {
         log_error_func("Invoking an invalid task.");
         return false;
     }
-    if(id == invalid_id())
+
+    auto& executor = get_global_context().executor;
+    auto idle_id = invalid_id();
     {
-        log_error_func("Invoking to an invalid thread.");
-        return false;
+        std::lock_guard<std::mutex> lock(executor.mutex);
+        if(!executor.idle_threads.empty())
+        {
+            // the most recently idle thread is the most likely to be warm.
+            // Handed under the lock, so that it is never listed as idle
+            // again before it took the task, even if it times out meanwhile
+            idle_id = executor.idle_threads.back();
+            executor.idle_threads.pop_back();
+            executor.handed_tasks[idle_id] = std::move(f);
+        }
+        else if(executor.threads_count < executor.config.max_threads)
+        {
+            executor.threads_count++;
+        }
+        else
+        {
+            executor.backlog.emplace_back(std::move(f));
+            return true;
+        }
     }
-    auto& global_context = get_global_context();
-    std::unique_lock<std::mutex> lock(global_context.mutex);
 
-    auto it = global_context.contexts.find(id);
-    if(it == global_context.contexts.end())
+    if(idle_id != invalid_id())
     {
-        return false;
+        unpark(idle_id);
+        return true;
     }
 
-    auto context = it->second;
-
-    lock.unlock();
-
-    std::lock_guard<std::mutex> remote_lock(context->tasks_mutex);
-
-    context->tasks.emplace_back(std::move(f));
-    context->wakeup = true;
-    context->wakeup_event.notify_all();
+    const std::string name = "tpp_executor";
+    thread executor_thread(name, run_executor_thread, name, std::move(f));
+    executor_thread.detach();
     return true;
 }
 } // namespace detail
@@ -397,7 +1533,51 @@ namespace this_thread
 {
 namespace detail
 {
-auto process_one(std::unique_lock<std::mutex>& lock) -> bool
+//-----------------------------------------------------------------------------
+/// Pops from the most urgent non empty lane. The urgent lanes are only
+/// looked at when something was queued to them.
+//-----------------------------------------------------------------------------
+auto pop_lane(thread_context& context, tpp::detail::task_queue& lane, task& callable) -> bool
+{
+    if(!lane.pop(callable))
+    {
+        return false;
+    }
+    if(context.max_tasks.load(std::memory_order_relaxed) != 0)
+    {
+        wake_blocked_producers(context, lane);
+    }
+    return true;
+}
+
+auto pop_lanes(thread_context& context, task& callable) -> bool
+{
+    if(context.urgent_pending.load(std::memory_order_acquire) != 0)
+    {
+        for(auto it = context.urgent_tasks.rbegin(); it != context.urgent_tasks.rend(); ++it)
+        {
+            if(pop_lane(context, *it, callable))
+            {
+                context.urgent_pending--;
+                return true;
+            }
+        }
+    }
+    return pop_lane(context, context.tasks, callable);
+}
+
+auto pop_task(thread_context& context, task& callable) -> bool
+{
+    // producers may be evicting from the lanes as well
+    if(context.evicting)
+    {
+        std::lock_guard<std::mutex> lock(context.evict_mutex);
+        return pop_lanes(context, callable);
+    }
+    return pop_lanes(context, callable);
+}
+
+auto process_one() -> bool
 {
     if(!has_local_context())
     {
@@ -409,39 +1589,43 @@ auto process_one(std::unique_lock<std::mutex>& lock) -> bool
     }
     auto& local_context = get_local_context();
 
-    if(prepare_tasks(local_context))
+    // counted before the pop so that the pending
+    // count never drops to zero while a task is in flight
+    local_context.processing_stack_depth++;
+
+    if(run_due_timer(local_context))
     {
-        auto task = std::move(local_context.processing_tasks[local_context.processing_idx]);
-        local_context.processing_idx++;
-        local_context.processing_stack_depth++;
-        lock.unlock();
+        local_context.processing_stack_depth--;
+        return true;
+    }
 
-        if(task)
+    task callable;
+    if(pop_task(local_context, callable))
+    {
+        if(callable)
         {
-            task();
-
-            // invoke the tasks's destructor to allow
-            // invoking from it on an unlocked mutex
-            task = {};
+            callable();
         }
 
-        lock.lock();
+        // invoke the tasks's destructor before
+        // the task is no longer counted as pending
+        callable = nullptr;
         local_context.processing_stack_depth--;
-
         return true;
     }
 
+    local_context.processing_stack_depth--;
     return false;
 }
 
-void process_all_for(std::unique_lock<std::mutex>& lock, const std::chrono::microseconds& rtime)
+void process_all_for(const std::chrono::microseconds& rtime)
 {
     auto now = clock::now();
     auto end_time = now + rtime;
 
     while(!notified_for_exit() && now < end_time)
     {
-        if(!process_one(lock))
+        if(!process_one())
         {
             break;
         }
@@ -450,11 +1634,11 @@ void process_all_for(std::unique_lock<std::mutex>& lock, const std::chrono::micr
     }
 }
 
-void process_all(std::unique_lock<std::mutex>& lock)
+void process_all()
 {
     while(!notified_for_exit())
     {
-        if(!process_one(lock))
+        if(!process_one())
         {
             break;
         }
@@ -470,11 +1654,8 @@ void process_for(const std::chrono::microseconds& rtime)
                        "this_thread::register_this_thread");
         return;
     }
-    auto& local_context = get_local_context();
 
-    std::unique_lock<std::mutex> lock(local_context.tasks_mutex);
-
-    process_all_for(lock, rtime);
+    process_all_for(rtime);
 }
 
 void process()
@@ -486,11 +1667,8 @@ void process()
                        "this_thread::register_this_thread");
         return;
     }
-    auto& local_context = get_local_context();
 
-    std::unique_lock<std::mutex> lock(local_context.tasks_mutex);
-
-    process_all(lock);
+    process_all();
 }
 
 auto wait_for(const std::chrono::microseconds& wait_duration) -> std::cv_status
@@ -506,9 +1684,7 @@ auto wait_for(const std::chrono::microseconds& wait_duration) -> std::cv_status
     }
     auto& local_context = get_local_context();
 
-    std::unique_lock<std::mutex> lock(local_context.tasks_mutex);
-
-    if(process_one(lock))
+    if(process_one())
     {
         return status;
     }
@@ -517,22 +1693,16 @@ auto wait_for(const std::chrono::microseconds& wait_duration) -> std::cv_status
         return status;
     }
 
-    // guard for spurious wakeups
-    auto predicate = [&]() -> bool
-    {
-        return local_context.wakeup;
-    };
-
-    local_context.wakeup = false;
-
-    if(!local_context.wakeup_event.wait_for(lock, wait_duration, predicate))
+    // wake up early for the next timer, which is not a timeout
+    auto deadline = clock::now() + wait_duration;
+    auto timer_deadline = local_context.timers.next_deadline();
+    status = park_until(local_context, std::min(deadline, timer_deadline));
+    if(timer_deadline < deadline)
     {
-        status = std::cv_status::timeout;
+        status = std::cv_status::no_timeout;
     }
 
-    local_context.wakeup = false;
-
-    process_one(lock);
+    process_one();
 
     return status;
 }
@@ -548,9 +1718,7 @@ void wait()
     }
     auto& local_context = get_local_context();
 
-    std::unique_lock<std::mutex> lock(local_context.tasks_mutex);
-
-    if(process_one(lock))
+    if(process_one())
     {
         return;
     }
@@ -560,32 +1728,30 @@ void wait()
         return;
     }
 
-    // guard for spurious wakeups
-    auto predicate = [&]() -> bool
+    auto timer_deadline = local_context.timers.next_deadline();
+    if(timer_deadline == clock::time_point::max())
     {
-        return local_context.wakeup;
-    };
-
-    local_context.wakeup = false;
-    // guard for spurious wakeups
-    local_context.wakeup_event.wait(lock, predicate);
-
-    local_context.wakeup = false;
+        park(local_context);
+    }
+    else
+    {
+        park_until(local_context, timer_deadline);
+    }
 
-    process_one(lock);
+    process_one();
 }
 } // namespace detail
 
 void register_this_thread()
 {
     auto context = register_thread_impl(std::this_thread::get_id(), {});
-    set_local_context(context.get());
+    set_local_context(context);
 }
 
 void register_this_thread(const std::string& name)
 {
     auto context = register_thread_impl(std::this_thread::get_id(), name);
-    set_local_context(context.get());
+    set_local_context(context);
 }
 
 void unregister_this_thread()
@@ -631,6 +1797,11 @@ auto get_id() -> thread::id
     return local_context.id;
 }
 
+auto get_handle() -> thread_handle
+{
+    return get_thread_handle(get_id());
+}
+
 auto get_depth() -> uint32_t
 {
     if(!has_local_context())
@@ -684,6 +1855,11 @@ auto thread::get_id() const -> thread::id
     return id_;
 }
 
+auto thread::get_handle() const -> thread_handle
+{
+    return get_thread_handle(id_);
+}
+
 void thread::join()
 {
     notify_for_exit(get_id());
@@ -693,7 +1869,10 @@ void thread::join()
 void thread::register_this(const std::string& name)
 {
     auto context = register_thread_impl(std::thread::get_id(), name);
-    id_ = context->id;
+    if(context != nullptr)
+    {
+        id_ = context->id;
+    }
 }
 
 thread::thread() noexcept = default;
@@ -724,14 +1903,31 @@ thread::~thread()
 
 auto set_thread_config(thread::id id, tasks_capacity_config config) -> bool
 {
-    return tpp::dispatch(id,
-                         [config]()
-                         {
-                             auto& local_context = get_local_context();
-                             std::lock_guard<std::mutex> lock(local_context.tasks_mutex);
-                             local_context.tasks.reserve(config.default_reserved_tasks);
-                             local_context.capacity_shrink_threashold = config.capacity_shrink_threashold;
-                         });
+    if(id == invalid_id())
+    {
+        log_error_func("Configuring an invalid thread.");
+        return false;
+    }
+
+    task f = [config]()
+    {
+        apply_tasks_capacity(get_local_context(), config);
+    };
+
+    if(has_local_context() && id == this_thread::get_id())
+    {
+        f();
+        return true;
+    }
+
+    pinned_context context(id);
+    if(!context)
+    {
+        return false;
+    }
+
+    // not subject to the capacity it changes
+    return detail::push_task(*context.get(), f);
 }
 
 } // namespace tpp
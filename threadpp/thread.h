@@ -1,17 +1,23 @@
 #pragma once
 #include "detail/utility/apply.hpp"
-#include "detail/utility/capture.hpp"
+#include "detail/utility/unique_function.hpp"
+#include "priority.h"
 
 #include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 namespace tpp
 {
+class thread_handle;
+
 //-----------------------------------------------------------------------------
 /// std::thread wrapper handling registration and exit notification
 //-----------------------------------------------------------------------------
@@ -52,6 +58,11 @@ public:
     //-----------------------------------------------------------------------------
     auto get_id() const -> id;
 
+    //-----------------------------------------------------------------------------
+    /// Returns a handle that can be invoked into without an id lookup
+    //-----------------------------------------------------------------------------
+    auto get_handle() const -> thread_handle;
+
     //-----------------------------------------------------------------------------
     /// Notifies and waits for a thread to finish its execution
     //-----------------------------------------------------------------------------
@@ -77,14 +88,137 @@ constexpr inline auto caller_id() -> thread::id
     return invalid_id();
 }
 
+struct thread_context;
+class pinned_context;
+
+//-----------------------------------------------------------------------------
+/// A resolved reference to a registered thread. Invoking through a handle
+/// enqueues directly into the thread without looking up its id.
+/// Once the thread unregisters the handle expires and invoking through it
+/// fails.
+//-----------------------------------------------------------------------------
+class thread_handle
+{
+public:
+    thread_handle() = default;
+
+    //-----------------------------------------------------------------------------
+    /// Returns the id of the referenced thread
+    //-----------------------------------------------------------------------------
+    auto get_id() const -> thread::id;
+
+    //-----------------------------------------------------------------------------
+    /// Checks whether the referenced thread has unregistered
+    //-----------------------------------------------------------------------------
+    auto expired() const -> bool;
+
+private:
+    friend auto get_thread_handle(thread::id id) -> thread_handle;
+    friend class pinned_context;
+
+    thread_handle(thread_context* context, thread::id id);
+
+    thread_context* context_{};
+    thread::id id_{invalid_id()};
+};
+
 using shared_thread = std::shared_ptr<thread>;
-using task = std::function<void()>;
+using task = unique_function<void()>;
 using clock = std::chrono::steady_clock;
 
+class timer_handle;
+namespace detail
+{
+struct timer_node;
+auto schedule_packaged_timer(thread::id id, task& f, clock::time_point deadline, clock::duration period)
+    -> timer_handle;
+auto schedule_packaged_timer(const thread_handle& handle,
+                             task& f,
+                             clock::time_point deadline,
+                             clock::duration period) -> timer_handle;
+// a zero period marks a one shot timer, these reject it
+auto schedule_packaged_periodic_timer(thread::id id, task& f, clock::duration period) -> timer_handle;
+auto schedule_packaged_periodic_timer(const thread_handle& handle, task& f, clock::duration period) -> timer_handle;
+} // namespace detail
+
+//-----------------------------------------------------------------------------
+/// A reference to a task scheduled via invoke_after, invoke_at or
+/// invoke_every. Dropping the handle does not cancel the task.
+//-----------------------------------------------------------------------------
+class timer_handle
+{
+public:
+    timer_handle() = default;
+    timer_handle(const timer_handle& rhs) noexcept;
+    timer_handle(timer_handle&& rhs) noexcept;
+    auto operator=(const timer_handle& rhs) noexcept -> timer_handle&;
+    auto operator=(timer_handle&& rhs) noexcept -> timer_handle&;
+    ~timer_handle();
+
+    //-----------------------------------------------------------------------------
+    /// Cancels the task. A run which has already started is not interrupted.
+    /// Returns true if the task was still scheduled.
+    //-----------------------------------------------------------------------------
+    auto cancel() -> bool;
+
+    //-----------------------------------------------------------------------------
+    /// Checks whether the task has either run, for a one shot timer,
+    /// or has been cancelled.
+    //-----------------------------------------------------------------------------
+    auto expired() const -> bool;
+
+    void swap(timer_handle& rhs) noexcept;
+
+private:
+    friend auto detail::schedule_packaged_timer(thread::id id,
+                                                task& f,
+                                                clock::time_point deadline,
+                                                clock::duration period) -> timer_handle;
+    friend auto detail::schedule_packaged_timer(const thread_handle& handle,
+                                                task& f,
+                                                clock::time_point deadline,
+                                                clock::duration period) -> timer_handle;
+
+    explicit timer_handle(detail::timer_node* node) noexcept;
+
+    detail::timer_node* node_{};
+};
+
+//-----------------------------------------------------------------------------
+/// What invoking into a thread does once its mailbox is full.
+/// block waits for the thread to take a task, fail makes invoke return false
+/// and drop_oldest discards the oldest queued task to make room.
+/// Note that threads blocking on each other's full mailboxes deadlock.
+//-----------------------------------------------------------------------------
+enum class overflow_policy
+{
+    block,
+    fail,
+    drop_oldest
+};
+
 struct tasks_capacity_config
 {
+    // task nodes allocated up front and the most kept for reuse once free
     std::size_t default_reserved_tasks{16};
     std::size_t capacity_shrink_threashold{256};
+    // maximum number of queued tasks per priority lane, 0 for unbounded
+    std::size_t max_tasks{0};
+    overflow_policy overflow{overflow_policy::block};
+};
+
+//-----------------------------------------------------------------------------
+/// Configures the default executor running the async and then
+/// overloads which take no thread id. Its threads are created on demand,
+/// reused while busy work keeps coming and exit after being idle for
+/// idle_timeout. Once max_threads are busy tasks are queued until
+/// one of them frees up.
+//-----------------------------------------------------------------------------
+struct executor_config
+{
+    std::size_t min_threads{0};
+    std::size_t max_threads{std::numeric_limits<std::size_t>::max()};
+    std::chrono::milliseconds idle_timeout{std::chrono::seconds(10)};
 };
 
 struct init_data
@@ -94,6 +228,7 @@ struct init_data
     std::function<void(const std::string&)> set_thread_name{};
     std::function<void(const std::string&)> on_thread_start{};
     tasks_capacity_config tasks_capacity{};
+    executor_config default_executor{};
 };
 
 //-----------------------------------------------------------------------------
@@ -110,9 +245,46 @@ auto shutdown(const std::chrono::seconds& wait_time = std::chrono::seconds(5)) -
 
 //-----------------------------------------------------------------------------
 /// Queues a task to be executed on the specified thread and notifies it.
+/// If the mailbox of the thread is bounded and full, the thread's
+/// overflow_policy decides whether this waits, fails or drops a task.
 //-----------------------------------------------------------------------------
 template<typename F, typename... Args>
 auto invoke(thread::id id, F&& f, Args&&... args) -> bool;
+template<typename F, typename... Args>
+auto invoke(const thread_handle& handle, F&& f, Args&&... args) -> bool;
+
+//-----------------------------------------------------------------------------
+/// Queues a task in the lane of the given priority category.
+/// The thread drains the lanes most urgent first and each lane in order.
+/// Tasks queued with the normal category are the same as a plain invoke.
+//-----------------------------------------------------------------------------
+template<typename F, typename... Args>
+auto invoke(thread::id id, priority::category level, F&& f, Args&&... args) -> bool;
+template<typename F, typename... Args>
+auto invoke(const thread_handle& handle, priority::category level, F&& f, Args&&... args) -> bool;
+
+//-----------------------------------------------------------------------------
+/// Like invoke but never waits for room in a full mailbox.
+/// Returns false instead, unless the policy of the thread is drop_oldest.
+//-----------------------------------------------------------------------------
+template<typename F, typename... Args>
+auto try_invoke(thread::id id, F&& f, Args&&... args) -> bool;
+template<typename F, typename... Args>
+auto try_invoke(const thread_handle& handle, F&& f, Args&&... args) -> bool;
+
+//-----------------------------------------------------------------------------
+/// Queues a batch of callables to be executed in order on the specified thread
+/// with a single enqueue and at most one wakeup. Callables are moved from if
+/// the range is an rvalue. Returns how many were accepted.
+//-----------------------------------------------------------------------------
+template<typename Range>
+auto invoke_bulk(thread::id id, Range&& callables) -> std::size_t;
+template<typename Range>
+auto invoke_bulk(const thread_handle& handle, Range&& callables) -> std::size_t;
+template<typename InputIt>
+auto invoke_bulk(thread::id id, InputIt first, InputIt last) -> std::size_t;
+template<typename InputIt>
+auto invoke_bulk(const thread_handle& handle, InputIt first, InputIt last) -> std::size_t;
 
 //-----------------------------------------------------------------------------
 /// If the calling thread is the same as the one passed it then
@@ -120,6 +292,47 @@ auto invoke(thread::id id, F&& f, Args&&... args) -> bool;
 //-----------------------------------------------------------------------------
 template<typename F, typename... Args>
 auto dispatch(thread::id id, F&& f, Args&&... args) -> bool;
+template<typename F, typename... Args>
+auto dispatch(const thread_handle& handle, F&& f, Args&&... args) -> bool;
+
+//-----------------------------------------------------------------------------
+/// Schedules a task to be executed on the specified thread once the delay
+/// has elapsed. The thread runs it from its processing loop, and while
+/// waiting it sleeps until the earliest of its deadlines.
+/// Returns an expired handle if the thread is not registered.
+//-----------------------------------------------------------------------------
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_after(thread::id id, const std::chrono::duration<Rep, Period>& delay, F&& f, Args&&... args)
+    -> timer_handle;
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_after(const thread_handle& handle, const std::chrono::duration<Rep, Period>& delay, F&& f, Args&&... args)
+    -> timer_handle;
+
+//-----------------------------------------------------------------------------
+/// Schedules a task to be executed on the specified thread once
+/// abs_time has been reached.
+//-----------------------------------------------------------------------------
+template<typename Clock, typename Duration, typename F, typename... Args>
+auto invoke_at(thread::id id, const std::chrono::time_point<Clock, Duration>& abs_time, F&& f, Args&&... args)
+    -> timer_handle;
+template<typename Clock, typename Duration, typename F, typename... Args>
+auto invoke_at(const thread_handle& handle,
+               const std::chrono::time_point<Clock, Duration>& abs_time,
+               F&& f,
+               Args&&... args) -> timer_handle;
+
+//-----------------------------------------------------------------------------
+/// Schedules a task to be executed on the specified thread every period,
+/// starting one period from now, until cancelled. Runs which were missed
+/// because the thread was busy are skipped rather than run back to back.
+/// The period must be positive, otherwise an expired handle is returned.
+//-----------------------------------------------------------------------------
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_every(thread::id id, const std::chrono::duration<Rep, Period>& period, F&& f, Args&&... args)
+    -> timer_handle;
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_every(const thread_handle& handle, const std::chrono::duration<Rep, Period>& period, F&& f, Args&&... args)
+    -> timer_handle;
 
 //-----------------------------------------------------------------------------
 /// Wakes up a thread if sleeping via any of the itc blocking mechanisms.
@@ -138,6 +351,12 @@ void notify_for_exit(thread::id id);
 //-----------------------------------------------------------------------------
 auto register_thread(std::thread::id id, const std::string& name = {}) -> thread::id;
 
+//-----------------------------------------------------------------------------
+/// Resolves a registered thread id to a handle.
+/// Returns an expired handle if the id is not registered.
+//-----------------------------------------------------------------------------
+auto get_thread_handle(thread::id id) -> thread_handle;
+
 //-----------------------------------------------------------------------------
 /// Automatically register and run a thread with a prepared loop ready to be
 /// invoked into.
@@ -163,6 +382,8 @@ struct task_info
 {
     size_t count{};
     std::string thread_name{};
+    // bytes held by the mailbox, both queued and pooled task nodes
+    size_t memory_usage{};
 };
 auto get_pending_task_count_detailed(thread::id id) -> task_info;
 
@@ -203,6 +424,11 @@ auto notified_for_exit() -> bool;
 //-----------------------------------------------------------------------------
 auto get_id() -> thread::id;
 
+//-----------------------------------------------------------------------------
+/// Gets a handle to the current thread. Returns expired handle if not registered.
+//-----------------------------------------------------------------------------
+auto get_handle() -> thread_handle;
+
 //-----------------------------------------------------------------------------
 /// Process all tasks.
 //-----------------------------------------------------------------------------
@@ -273,18 +499,111 @@ namespace detail
 template<typename F, typename... Args>
 auto package_simple_task(F&& f, Args&&... args) -> task
 {
-    return [callable = capture(std::forward<F>(f)), params = capture(std::forward<Args>(args)...)]() mutable
+    return [callable = std::forward<F>(f), params = std::make_tuple(std::forward<Args>(args)...)]() mutable
     {
         utility::apply(
             [&callable](std::decay_t<Args>&... args)
             {
-                std::forward<F>(std::get<0>(callable.get()))(std::forward<Args>(args)...);
+                std::forward<F>(callable)(std::forward<Args>(args)...);
             },
-            params.get());
+            params);
     };
 }
 
+inline auto package_simple_task(task&& f) -> task
+{
+    return std::move(f);
+}
+
+// the arguments are passed as lvalues as the task is called repeatedly
+template<typename F, typename... Args>
+auto package_repeating_task(F&& f, Args&&... args) -> task
+{
+    return [callable = std::forward<F>(f), params = std::make_tuple(std::forward<Args>(args)...)]() mutable
+    {
+        utility::apply(callable, params);
+    };
+}
+
+inline auto package_repeating_task(task&& f) -> task
+{
+    return std::move(f);
+}
+
+template<typename InputIt>
+void reserve_tasks(std::vector<task>& tasks, InputIt first, InputIt last, std::forward_iterator_tag)
+{
+    tasks.reserve(static_cast<std::size_t>(std::distance(first, last)));
+}
+
+template<typename InputIt>
+void reserve_tasks(std::vector<task>& /*tasks*/, InputIt /*first*/, InputIt /*last*/, std::input_iterator_tag)
+{
+}
+
+template<typename InputIt>
+auto package_simple_tasks(InputIt first, InputIt last) -> std::vector<task>
+{
+    std::vector<task> tasks;
+    reserve_tasks(tasks, first, last, typename std::iterator_traits<InputIt>::iterator_category{});
+    for(; first != last; ++first)
+    {
+        tasks.emplace_back(package_simple_task(*first));
+    }
+    return tasks;
+}
+
+template<typename Range>
+auto package_simple_tasks(Range& callables, std::true_type /*is_rvalue*/) -> std::vector<task>
+{
+    using std::begin;
+    using std::end;
+    return package_simple_tasks(std::make_move_iterator(begin(callables)), std::make_move_iterator(end(callables)));
+}
+
+template<typename Range>
+auto package_simple_tasks(Range& callables, std::false_type /*is_rvalue*/) -> std::vector<task>
+{
+    using std::begin;
+    using std::end;
+    return package_simple_tasks(begin(callables), end(callables));
+}
+
 auto invoke_packaged_task(thread::id id, task& f) -> bool;
+auto invoke_packaged_task(const thread_handle& handle, task& f) -> bool;
+auto invoke_packaged_task(thread::id id, task& f, priority::category level) -> bool;
+auto invoke_packaged_task(const thread_handle& handle, task& f, priority::category level) -> bool;
+auto try_invoke_packaged_task(thread::id id, task& f) -> bool;
+auto try_invoke_packaged_task(const thread_handle& handle, task& f) -> bool;
+auto invoke_packaged_tasks(thread::id id, task* tasks, std::size_t count) -> std::size_t;
+auto invoke_packaged_tasks(const thread_handle& handle, task* tasks, std::size_t count) -> std::size_t;
+auto invoke_default_executor(task& f) -> bool;
+
+//-----------------------------------------------------------------------------
+/// Wakes up the thread if it is parked in this_thread::wait without
+/// queueing a task. Unlike notify it does not allocate.
+//-----------------------------------------------------------------------------
+void unpark(thread::id id);
+
+//-----------------------------------------------------------------------------
+/// Work a thread can do instead of blocking on a future, e.g. a pool
+/// worker running the other jobs of its pool. help returns false when
+/// there is nothing to do, after which the thread blocks until it is
+/// unparked or the future is ready. stop_helping ends the wait.
+//-----------------------------------------------------------------------------
+class wait_helper
+{
+public:
+    virtual ~wait_helper() = default;
+    virtual auto help() -> bool = 0;
+    virtual void stop_helping() = 0;
+};
+
+//-----------------------------------------------------------------------------
+/// Sets the wait helper of the calling thread. Returns the previous one.
+//-----------------------------------------------------------------------------
+auto exchange_wait_helper(wait_helper* helper) -> wait_helper*;
+auto get_wait_helper() -> wait_helper*;
 } // namespace detail
 
 // apply perfect forwarding to the callable and arguments
@@ -297,6 +616,69 @@ auto invoke(thread::id id, F&& f, Args&&... args) -> bool
     return detail::invoke_packaged_task(id, task);
 }
 
+template<typename F, typename... Args>
+auto invoke(const thread_handle& handle, F&& f, Args&&... args) -> bool
+{
+    auto task = detail::package_simple_task(std::forward<F>(f), std::forward<Args>(args)...);
+    return detail::invoke_packaged_task(handle, task);
+}
+
+template<typename F, typename... Args>
+auto invoke(thread::id id, priority::category level, F&& f, Args&&... args) -> bool
+{
+    auto task = detail::package_simple_task(std::forward<F>(f), std::forward<Args>(args)...);
+    return detail::invoke_packaged_task(id, task, level);
+}
+
+template<typename F, typename... Args>
+auto invoke(const thread_handle& handle, priority::category level, F&& f, Args&&... args) -> bool
+{
+    auto task = detail::package_simple_task(std::forward<F>(f), std::forward<Args>(args)...);
+    return detail::invoke_packaged_task(handle, task, level);
+}
+
+template<typename F, typename... Args>
+auto try_invoke(thread::id id, F&& f, Args&&... args) -> bool
+{
+    auto task = detail::package_simple_task(std::forward<F>(f), std::forward<Args>(args)...);
+    return detail::try_invoke_packaged_task(id, task);
+}
+
+template<typename F, typename... Args>
+auto try_invoke(const thread_handle& handle, F&& f, Args&&... args) -> bool
+{
+    auto task = detail::package_simple_task(std::forward<F>(f), std::forward<Args>(args)...);
+    return detail::try_invoke_packaged_task(handle, task);
+}
+
+template<typename Range>
+auto invoke_bulk(thread::id id, Range&& callables) -> std::size_t
+{
+    auto tasks = detail::package_simple_tasks(callables, std::is_rvalue_reference<Range&&>{});
+    return detail::invoke_packaged_tasks(id, tasks.data(), tasks.size());
+}
+
+template<typename Range>
+auto invoke_bulk(const thread_handle& handle, Range&& callables) -> std::size_t
+{
+    auto tasks = detail::package_simple_tasks(callables, std::is_rvalue_reference<Range&&>{});
+    return detail::invoke_packaged_tasks(handle, tasks.data(), tasks.size());
+}
+
+template<typename InputIt>
+auto invoke_bulk(thread::id id, InputIt first, InputIt last) -> std::size_t
+{
+    auto tasks = detail::package_simple_tasks(first, last);
+    return detail::invoke_packaged_tasks(id, tasks.data(), tasks.size());
+}
+
+template<typename InputIt>
+auto invoke_bulk(const thread_handle& handle, InputIt first, InputIt last) -> std::size_t
+{
+    auto tasks = detail::package_simple_tasks(first, last);
+    return detail::invoke_packaged_tasks(handle, tasks.data(), tasks.size());
+}
+
 // apply perfect forwarding to the callable and arguments
 // so that so that using invoke/dispatch will result
 // in the same number of calls to constructors
@@ -315,7 +697,75 @@ auto dispatch(thread::id id, F&& f, Args&&... args) -> bool
     }
 }
 
-// set thread config if you want to use different capasity sizes than default from init
+template<typename F, typename... Args>
+auto dispatch(const thread_handle& handle, F&& f, Args&&... args) -> bool
+{
+    if(this_thread::get_id() == handle.get_id())
+    {
+        // directly call it
+        std::forward<F>(f)(std::forward<Args>(args)...);
+        return true;
+    }
+    else
+    {
+        return invoke(handle, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+}
+
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_after(thread::id id, const std::chrono::duration<Rep, Period>& delay, F&& f, Args&&... args)
+    -> timer_handle
+{
+    auto task = detail::package_simple_task(std::forward<F>(f), std::forward<Args>(args)...);
+    auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(delay);
+    return detail::schedule_packaged_timer(id, task, deadline, clock::duration::zero());
+}
+
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_after(const thread_handle& handle, const std::chrono::duration<Rep, Period>& delay, F&& f, Args&&... args)
+    -> timer_handle
+{
+    auto task = detail::package_simple_task(std::forward<F>(f), std::forward<Args>(args)...);
+    auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(delay);
+    return detail::schedule_packaged_timer(handle, task, deadline, clock::duration::zero());
+}
+
+template<typename Clock, typename Duration, typename F, typename... Args>
+auto invoke_at(thread::id id, const std::chrono::time_point<Clock, Duration>& abs_time, F&& f, Args&&... args)
+    -> timer_handle
+{
+    return invoke_after(id, abs_time - Clock::now(), std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template<typename Clock, typename Duration, typename F, typename... Args>
+auto invoke_at(const thread_handle& handle,
+               const std::chrono::time_point<Clock, Duration>& abs_time,
+               F&& f,
+               Args&&... args) -> timer_handle
+{
+    return invoke_after(handle, abs_time - Clock::now(), std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_every(thread::id id, const std::chrono::duration<Rep, Period>& period, F&& f, Args&&... args)
+    -> timer_handle
+{
+    auto task = detail::package_repeating_task(std::forward<F>(f), std::forward<Args>(args)...);
+    return detail::schedule_packaged_periodic_timer(id, task, std::chrono::duration_cast<clock::duration>(period));
+}
+
+template<typename Rep, typename Period, typename F, typename... Args>
+auto invoke_every(const thread_handle& handle, const std::chrono::duration<Rep, Period>& period, F&& f, Args&&... args)
+    -> timer_handle
+{
+    auto task = detail::package_repeating_task(std::forward<F>(f), std::forward<Args>(args)...);
+    return detail::schedule_packaged_periodic_timer(handle,
+                                                    task,
+                                                    std::chrono::duration_cast<clock::duration>(period));
+}
+
+// set thread config if you want to use different capasity sizes than default from init.
+// the capacity and overflow policy take effect once the thread processes the change
 auto set_thread_config(thread::id id, tasks_capacity_config config) -> bool;
 
 namespace this_thread
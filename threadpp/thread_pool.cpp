@@ -1,10 +1,17 @@
 #include "thread_pool.h"
+#include "detail/indexed_heap.hpp"
+#include "detail/work_stealing_deque.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <limits>
 #include <map>
 #include <mutex>
 #include <queue>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace tpp
@@ -18,32 +25,210 @@ class thread_pool::impl
         priority::group group;
     };
 
+    // a job queued in the work stealing scheduler
+    struct stealing_job
+    {
+        job_id id = 0;
+        priority::group group;
+        std::uint64_t sequence = 0;
+        task callable;
+        // set once by whoever runs, cancels or requeues the job
+        std::atomic<bool> claimed{false};
+    };
+
+    //-----------------------------------------------------------------------------
+    /// A slot of the job table. The id of a job combines its slot with a
+    /// generation so that the id of a released job never matches a job
+    /// which reuses the slot. Free slots have an id of 0.
+    //-----------------------------------------------------------------------------
     struct job_info
     {
         job_handle handle;
 
         task callable;
-        shared_future<void> callable_future;
+
+        // created only once somebody waits for the job through the pool
+        std::unique_ptr<promise<void>> done;
+        shared_future<void> done_future;
+
+        // position in the queue of its category while queued
+        size_t queue_index = size_t(-1);
+        // the greater rank is taken first, the earlier scheduled on a tie
+        std::int64_t rank = 0;
+        std::uint64_t sequence = 0;
+        clock::time_point queued{};
+
+        // owned by the queue it is in, work stealing scheduler only
+        stealing_job* node{};
     };
 
-    friend bool operator<(const job_handle& lhs, const job_handle& rhs)
+    struct job_info_less
     {
-        return lhs.group.priority < rhs.group.priority;
-    }
+        auto operator()(const job_info* lhs, const job_info* rhs) const -> bool
+        {
+            if(lhs->rank != rhs->rank)
+            {
+                return lhs->rank < rhs->rank;
+            }
+            return lhs->sequence > rhs->sequence;
+        }
+    };
+
+    struct job_info_position
+    {
+        void operator()(job_info* job, size_t index) const
+        {
+            job->queue_index = index;
+        }
+    };
+
+    struct stealing_job_less
+    {
+        auto operator()(const stealing_job* lhs, const stealing_job* rhs) const -> bool
+        {
+            if(lhs->group.priority != rhs->group.priority)
+            {
+                return lhs->group.priority < rhs->group.priority;
+            }
+            return lhs->sequence > rhs->sequence;
+        }
+    };
+
+    struct stealing_worker
+    {
+        impl* owner{};
+        priority::category level{};
+        thread::id id{};
+        detail::work_stealing_deque<stealing_job*> jobs;
+        std::atomic<bool> idle{false};
+        std::uint32_t seed{};
+    };
+
+    struct idle_worker
+    {
+        thread::id id{};
+        // elastic categories only
+        clock::time_point since{};
+    };
+
+    //-----------------------------------------------------------------------------
+    /// Installed while a worker runs jobs, so that a job waiting on a
+    /// future runs the other jobs of the pool meanwhile instead of
+    /// blocking the worker. Nested fork/join can not deadlock this way.
+    //-----------------------------------------------------------------------------
+    struct job_helper final : detail::wait_helper
+    {
+        job_helper(impl* owner, thread::id worker, priority::category level)
+            : owner(owner)
+            , worker(worker)
+            , level(level)
+        {
+        }
+
+        auto help() -> bool override
+        {
+            return owner->help(worker, level);
+        }
+
+        void stop_helping() override
+        {
+            owner->stop_helping(worker);
+        }
+
+        impl* owner{};
+        thread::id worker{};
+        priority::category level{};
+    };
+
+    struct stealing_helper final : detail::wait_helper
+    {
+        stealing_helper(impl* owner, stealing_worker& self)
+            : owner(owner)
+            , self(self)
+        {
+        }
+
+        auto help() -> bool override
+        {
+            return owner->help_stealing(self);
+        }
+
+        void stop_helping() override
+        {
+            owner->set_busy(self);
+        }
+
+        impl* owner{};
+        stealing_worker& self;
+    };
+
+    // blocked on a future in a job
+    struct waiting_worker
+    {
+        thread::id id{};
+        priority::category level{};
+    };
+
+    struct elastic_category
+    {
+        // grows and shrinks within the bounds
+        bool enabled = false;
+        // waiting jobs of it make an elastic category grow
+        bool tracked = false;
+        size_t min_workers = 0;
+        size_t max_workers = 0;
+        size_t next_index = 0;
+        // since when its jobs have been waiting for a worker
+        clock::time_point backlog_since{};
+        bool spawn_pending = false;
+        bool retire_pending = false;
+    };
+
+    struct injection_queue
+    {
+        std::mutex guard;
+        std::priority_queue<stealing_job*, std::vector<stealing_job*>, stealing_job_less> jobs;
+        std::atomic<size_t> count{0};
+    };
+
+    static constexpr size_t categories_count = priority::categories_count;
+    static constexpr size_t slot_bits = 32;
+    static constexpr job_id slot_mask = (job_id(1) << slot_bits) - 1;
+    // the pass of a category advances by this over its weight per job
+    static constexpr std::uint64_t fair_stride = std::uint64_t(1) << 20;
 
     using workers = std::vector<tpp::thread>;
     using priority_workers = std::map<priority::category, workers>;
-    using jobs_queue = std::priority_queue<job_handle>;
+    using jobs_queue = detail::indexed_heap<job_info*, job_info_less, job_info_position>;
     using priority_queues = std::map<priority::category, jobs_queue>;
 
 public:
-    impl(const std::map<priority::category, size_t>& workers_per_priority_level, tasks_capacity_config config)
+    impl(const std::map<priority::category, size_t>& workers_per_priority_level,
+         tasks_capacity_config config,
+         thread_pool_config pool_config)
+        : scheduler_(pool_config.scheduler)
+        , policy_(pool_config.policy)
+        , weights_(pool_config.weights)
+        , aging_interval_(std::max<clock::duration>(pool_config.aging_interval, clock::duration(1)))
+        , max_rank_priority_(policy_ == scheduling_policy::aging
+                                 ? std::numeric_limits<std::int64_t>::max() / aging_interval_.count()
+                                 : std::numeric_limits<std::int64_t>::max())
+        , spawn_delay_(pool_config.spawn_delay)
+        , idle_timeout_(pool_config.idle_timeout)
+        , worker_config_(config)
     {
-        jobs_.reserve(config.default_reserved_tasks);
-        for(const auto& kvp : workers_per_priority_level)
+        auto counts = workers_per_priority_level;
+        if(scheduler_ == scheduler_type::shared_queue)
+        {
+            apply_elastic_config(pool_config, counts);
+        }
+
+        std::unique_lock<std::mutex> lock(guard_);
+        for(const auto& kvp : counts)
         {
             auto level = kvp.first;
             auto count = kvp.second;
+            elastic_[size_t(level)].next_index = count;
             if(count > 0)
             {
                 job_priority_queues_[level];
@@ -51,13 +236,38 @@ public:
                 workers_for_level.reserve(count);
                 for(size_t i = 0; i < count; ++i)
                 {
-                    std::string name = "pool_w:" + std::to_string(unsigned(level)) + ":" + std::to_string(i);
-                    workers_for_level.emplace_back(make_thread(name));
+                    workers_for_level.emplace_back(make_thread(get_worker_name(level, i)));
                     auto& task = workers_for_level.back();
                     tpp::set_thread_config(task.get_id(), config);
+
+                    if(scheduler_ == scheduler_type::shared_queue)
+                    {
+                        set_idle(task.get_id(), level);
+                    }
+                    else
+                    {
+                        auto worker = std::make_unique<stealing_worker>();
+                        worker->owner = this;
+                        worker->level = level;
+                        worker->id = task.get_id();
+                        worker->seed = std::uint32_t(stealing_workers_.size() + 1);
+                        stealing_workers_.emplace_back(std::move(worker));
+                    }
                 }
             }
         }
+        lock.unlock();
+
+        // start the loops only after all workers are known to each other
+        for(auto& worker : stealing_workers_)
+        {
+            auto w = worker.get();
+            invoke(w->id,
+                   [this, w]()
+                   {
+                       worker_loop(*w);
+                   });
+        }
     }
 
     impl(impl&&) = delete;
@@ -67,6 +277,12 @@ public:
 
     ~impl()
     {
+        // nothing gets spawned or retired from here on
+        if(supervisor_.joinable())
+        {
+            supervisor_.join();
+        }
+
         clear_all();
 
         auto workers = [&]()
@@ -76,70 +292,174 @@ public:
         }();
 
         workers.clear();
+
+        // workers are joined, nobody touches the queues anymore
+        for(auto& worker : stealing_workers_)
+        {
+            while(auto node = worker->jobs.pop())
+            {
+                delete node;
+            }
+        }
+        for(auto& queue : injection_)
+        {
+            while(!queue.jobs.empty())
+            {
+                delete queue.jobs.top();
+                queue.jobs.pop();
+            }
+        }
     }
 
     auto add_job(task& user_job, priority::group group) -> job_id
     {
-        auto packaged_task = detail::package_future_task(std::move(user_job));
+        if(scheduler_ == scheduler_type::work_stealing)
+        {
+            stealing_job* node = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(guard_);
+                node = add_stealing_job(user_job, group);
+            }
+            auto id = node->id;
+            enqueue(&node, 1, group.level);
+            return id;
+        }
+
         std::lock_guard<std::mutex> lock(guard_);
-        auto id = free_id_++;
-        auto& job = jobs_[id];
-        job.handle.id = id;
-        job.handle.group = group;
-        job.callable = std::move(packaged_task.callable);
-        job.callable_future = packaged_task.callable_future.share();
+        auto& job = acquire_job(group);
+        job.callable = std::move(user_job);
 
-        add_job_handle(job.handle);
-        return id;
+        queue_job(job);
+        return job.handle.id;
     }
 
-    void change_priority(job_id id, priority::group group)
+    void add_jobs(task* user_jobs, size_t count, priority::group group, job_id* ids)
     {
+        if(scheduler_ == scheduler_type::work_stealing)
+        {
+            std::vector<stealing_job*> nodes;
+            nodes.reserve(count);
+            {
+                std::lock_guard<std::mutex> lock(guard_);
+                for(size_t i = 0; i < count; ++i)
+                {
+                    nodes.emplace_back(add_stealing_job(user_jobs[i], group));
+                    ids[i] = nodes.back()->id;
+                }
+            }
+            enqueue(nodes.data(), nodes.size(), group.level);
+            return;
+        }
+
         std::lock_guard<std::mutex> lock(guard_);
+        for(size_t i = 0; i < count; ++i)
+        {
+            auto& job = acquire_job(group);
+            job.callable = std::move(user_jobs[i]);
+            ids[i] = job.handle.id;
 
-        auto it = jobs_.find(id);
-        if(it == jobs_.end())
+            job_priority_queues_[group.level].push(&job);
+        }
+
+        notify_workers(group.level, count);
+    }
+
+    void change_priority(job_id id, priority::group group)
+    {
+        if(scheduler_ == scheduler_type::work_stealing)
         {
+            change_stealing_job_priority(id, group);
             return;
         }
 
-        job_info& job = it->second;
+        std::lock_guard<std::mutex> lock(guard_);
 
-        if(!job.callable || job.handle.group == group)
+        // only queued jobs can be moved
+        auto job = find_job(id);
+        if(job == nullptr || job->queue_index == jobs_queue::npos || job->handle.group == group)
         {
             return;
         }
 
-        job.handle.group = group;
+        // keeps its place among the jobs of equal rank
+        auto& queue = job_priority_queues_[job->handle.group.level];
+        if(job->handle.group.level == group.level)
+        {
+            job->handle.group = group;
+            job->rank = get_rank(*job);
+            queue.update(job->queue_index);
+            return;
+        }
 
-        add_job_handle(job.handle);
+        queue.erase(job->queue_index);
+        job->handle.group = group;
+        job->rank = get_rank(*job);
+        queue_job(*job);
     }
 
     void clear(job_id id, bool check_callable)
     {
-        std::lock_guard<std::mutex> lock(guard_);
-        auto it = jobs_.find(id);
-        if(it != jobs_.end())
+        std::unique_ptr<promise<void>> done;
         {
+            std::lock_guard<std::mutex> lock(guard_);
+            auto job = find_job(id);
+            if(job == nullptr)
+            {
+                return;
+            }
+
             if(check_callable)
             {
-                if(it->second.callable)
+                auto pending = job->node ? !job->node->claimed.exchange(true) : bool(job->callable);
+                if(!pending)
                 {
-                    jobs_.erase(id);
+                    return;
                 }
             }
-            else
-            {
-                jobs_.erase(id);
-            }
+            done = release_job(*job);
+        }
+
+        if(done)
+        {
+            done->set_value();
         }
     }
 
     void clear_all()
     {
-        std::lock_guard<std::mutex> lock(guard_);
-        jobs_.clear();
-        job_priority_queues_.clear();
+        std::vector<std::unique_ptr<promise<void>>> done;
+        {
+            std::lock_guard<std::mutex> lock(guard_);
+            for(auto& kvp : job_priority_queues_)
+            {
+                kvp.second.clear();
+            }
+
+            for(auto& job : jobs_)
+            {
+                if(job.handle.id == 0)
+                {
+                    continue;
+                }
+
+                // cancelled nodes are released when they get dequeued,
+                // the running jobs are released by their workers
+                auto pending = job.node ? !job.node->claimed.exchange(true) : bool(job.callable);
+                if(!pending)
+                {
+                    continue;
+                }
+                if(auto job_done = release_job(job))
+                {
+                    done.emplace_back(std::move(job_done));
+                }
+            }
+        }
+
+        for(auto& job_done : done)
+        {
+            job_done->set_value();
+        }
     }
 
     void wait(job_id id)
@@ -147,12 +467,12 @@ public:
         auto f = [this, id]()
         {
             std::lock_guard<std::mutex> lock(guard_);
-            auto it = jobs_.find(id);
-            if(it == jobs_.end())
+            auto job = find_job(id);
+            if(job == nullptr)
             {
                 return make_ready_future().share();
             }
-            return it->second.callable_future;
+            return get_done_future(*job);
         }();
 
         f.wait();
@@ -163,12 +483,14 @@ public:
         std::vector<shared_future<void>> futures;
         {
             std::lock_guard<std::mutex> lock(guard_);
-            futures.reserve(jobs_.size());
+            futures.reserve(jobs_count_);
 
-            for(const auto& jobkvp : jobs_)
+            for(auto& job : jobs_)
             {
-                auto& job = jobkvp.second;
-                futures.emplace_back(job.callable_future);
+                if(job.handle.id != 0)
+                {
+                    futures.emplace_back(get_done_future(job));
+                }
             }
         }
 
@@ -181,34 +503,193 @@ public:
     auto get_jobs_count() const -> size_t
     {
         std::lock_guard<std::mutex> lock(guard_);
-        return jobs_.size();
+        return jobs_count_;
+    }
+
+    auto get_workers_count() const -> size_t
+    {
+        std::lock_guard<std::mutex> lock(guard_);
+        size_t count = 0;
+        for(const auto& kvp : workers_)
+        {
+            count += kvp.second.size();
+        }
+        return count;
+    }
+
+    auto get_workers_count(priority::category level) const -> size_t
+    {
+        std::lock_guard<std::mutex> lock(guard_);
+        auto it = workers_.find(level);
+        return it != workers_.end() ? it->second.size() : 0;
+    }
+
+    auto get_spawned_workers_count() const -> size_t
+    {
+        std::lock_guard<std::mutex> lock(guard_);
+        return spawned_count_;
+    }
+
+    auto get_retired_workers_count() const -> size_t
+    {
+        std::lock_guard<std::mutex> lock(guard_);
+        return retired_count_;
     }
 
 private:
-    void add_job_handle(job_handle handle)
+    //-----------------------------------------------------------------------------
+    /// Job table, expects guard_ to be locked
+    //-----------------------------------------------------------------------------
+    auto acquire_job(priority::group group) -> job_info&
     {
-        job_priority_queues_[handle.group.level].emplace(handle);
-        notify_workers(handle.group.level);
+        size_t slot = 0;
+        if(!free_slots_.empty())
+        {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        }
+        else
+        {
+            slot = jobs_.size();
+            jobs_.emplace_back();
+        }
+
+        auto& job = jobs_[slot];
+        job.handle.id = (++id_generator_ << slot_bits) | slot;
+        job.handle.group = group;
+        job.sequence = ++sequence_;
+        if(policy_ == scheduling_policy::aging)
+        {
+            job.queued = clock::now();
+        }
+        job.rank = get_rank(job);
+        ++jobs_count_;
+        return job;
     }
 
-    void notify_workers(priority::category max_priority)
+    //-----------------------------------------------------------------------------
+    /// With aging the rank is the priority plus the time the job has waited,
+    /// in levels of the aging interval. The current time is the same for
+    /// every job, so it is left out and the order of the queue stays valid.
+    /// The priority is capped so that neither can overflow.
+    //-----------------------------------------------------------------------------
+    auto get_rank(const job_info& job) const -> std::int64_t
     {
-        for(const auto& kvp : workers_)
+        auto priority = std::min<std::uint64_t>(job.handle.group.priority, std::uint64_t(max_rank_priority_));
+        auto rank = static_cast<std::int64_t>(priority);
+        if(policy_ == scheduling_policy::aging)
+        {
+            rank = rank * aging_interval_.count() - (job.queued - epoch_).count();
+        }
+        return rank;
+    }
+
+    auto find_job(job_id id) -> job_info*
+    {
+        auto slot = size_t(id & slot_mask);
+        if(id == 0 || slot >= jobs_.size() || jobs_[slot].handle.id != id)
+        {
+            return nullptr;
+        }
+        return &jobs_[slot];
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Frees the slot of a job. Returns the promise of its waiters which is
+    /// to be fulfilled once the guard is unlocked.
+    //-----------------------------------------------------------------------------
+    auto release_job(job_info& job) -> std::unique_ptr<promise<void>>
+    {
+        if(job.queue_index != jobs_queue::npos)
+        {
+            job_priority_queues_[job.handle.group.level].erase(job.queue_index);
+        }
+
+        free_slots_.emplace_back(size_t(job.handle.id & slot_mask));
+        --jobs_count_;
+
+        job.handle.id = 0;
+        job.callable = nullptr;
+        job.node = nullptr;
+        job.done_future = {};
+        return std::move(job.done);
+    }
+
+    auto get_done_future(job_info& job) -> shared_future<void>
+    {
+        if(!job.done)
         {
-            auto priority = kvp.first;
+            job.done = std::make_unique<promise<void>>();
+            job.done_future = job.done->get_future().share();
+        }
+        return job.done_future;
+    }
+
+    void queue_job(job_info& job)
+    {
+        job_priority_queues_[job.handle.group.level].push(&job);
+        notify_workers(job.handle.group.level);
+    }
 
-            if(priority <= max_priority)
+    // expects guard_ to be locked
+    void notify_workers(priority::category max_priority, size_t jobs_count = 1)
+    {
+        // wake at most one idle worker per job, preferring the ones
+        // closest to the job's level. Busy workers look for more
+        // jobs themselves before they become idle again.
+        for(auto it = idle_workers_.rbegin(); it != idle_workers_.rend() && jobs_count > 0; ++it)
+        {
+            auto level = it->first;
+            if(max_priority < level)
             {
-                auto& workers = workers_[priority];
-                for(auto& w : workers)
-                {
-                    dispatch(w.get_id(),
-                           [this, priority]()
-                           {
-                               check_jobs(priority);
-                           });
-                }
+                continue;
+            }
+
+            auto& idle = it->second;
+            while(!idle.empty() && jobs_count > 0)
+            {
+                auto worker = idle.back().id;
+                idle.pop_back();
+                --jobs_count;
+
+                invoke(worker,
+                       [this, worker, level]()
+                       {
+                           check_jobs(worker, level);
+                       });
+            }
+        }
+
+        // then the ones blocked on a future, they run it while waiting
+        for(auto it = waiting_workers_.begin(); it != waiting_workers_.end() && jobs_count > 0;)
+        {
+            if(max_priority < it->level)
+            {
+                ++it;
+                continue;
             }
+
+            detail::unpark(it->id);
+            it = waiting_workers_.erase(it);
+            --jobs_count;
+        }
+
+        if(jobs_count > 0)
+        {
+            note_backlog(max_priority);
+        }
+    }
+
+    auto select_queue_above(priority::category level) -> jobs_queue&
+    {
+        switch(policy_)
+        {
+            case scheduling_policy::weighted_fair:
+                return get_fair_queue_above(level);
+            case scheduling_policy::aging:
+                return get_aged_queue_above(level);
+            default:
+                return get_highest_priority_queue_above(level);
         }
     }
 
@@ -233,68 +714,770 @@ private:
         return job_priority_queues_[selected_level];
     }
 
-    void check_jobs(priority::category level)
+    //-----------------------------------------------------------------------------
+    /// Stride scheduling. The category with the lowest pass is picked and
+    /// its pass advances inversely to its weight. A category which was
+    /// empty does not get to catch up with what it missed meanwhile.
+    //-----------------------------------------------------------------------------
+    auto get_fair_queue_above(priority::category level) -> jobs_queue&
     {
-        if(this_thread::notified_for_exit())
-        {
-            return;
-        }
-
-        task user_job;
-        job_id id = 0;
+        priority::category selected_level = level;
+        std::uint64_t selected_pass = 0;
+        bool found = false;
 
+        for(const auto& kvp : job_priority_queues_)
         {
-            std::lock_guard<std::mutex> lock(guard_);
-            auto& job_queue = get_highest_priority_queue_above(level);
-
-            if(job_queue.empty())
-            {
-                return;
-            }
-            const auto& handle = job_queue.top();
-            auto it = jobs_.find(handle.id);
-            if(it == jobs_.end())
+            auto queue_priority_level = kvp.first;
+            if(queue_priority_level < level || kvp.second.empty())
             {
-                job_queue.pop();
-                return;
+                continue;
             }
-            auto& job = it->second;
 
-            // if priority level is lower still matches
-            if(level <= job.handle.group.level)
+            // a tie goes to the higher category
+            auto pass = std::max(passes_[size_t(queue_priority_level)], virtual_time_);
+            if(!found || pass <= selected_pass)
             {
-                id = job.handle.id;
-                user_job = std::move(job.callable);
+                selected_level = queue_priority_level;
+                selected_pass = pass;
+                found = true;
             }
-
-            job_queue.pop();
         }
-        ////////////
-        if(user_job)
+
+        if(found)
         {
-            user_job();
-            // clear after the call so that the task
-            // is waitable via the pool.
-            clear(id, false);
+            auto weight = std::max<std::uint64_t>(weights_[size_t(selected_level)], 1);
+            virtual_time_ = selected_pass;
+            passes_[size_t(selected_level)] = selected_pass + fair_stride / weight;
         }
+        return job_priority_queues_[selected_level];
     }
 
-    mutable std::mutex guard_;
-    job_id free_id_ = 1;
-    priority_workers workers_;
-    std::unordered_map<job_id, job_info> jobs_;
-    priority_queues job_priority_queues_;
-};
+    //-----------------------------------------------------------------------------
+    /// The next job of each category is raised a category for every aging
+    /// interval it has waited. The highest one is picked, the one which has
+    /// waited the longest on a tie.
+    //-----------------------------------------------------------------------------
+    auto get_aged_queue_above(priority::category level) -> jobs_queue&
+    {
+        priority::category selected_level = level;
+        size_t selected_effective_level = 0;
+        clock::time_point selected_queued{};
+        bool found = false;
 
-////////////////////////////////////////////////////////////
-thread_pool::thread_pool() : thread_pool({{priority::category::normal, thread::hardware_concurrency()}})
-{
-}
-thread_pool::thread_pool(const std::map<priority::category, size_t>& workers_per_priority_level,
-                         tasks_capacity_config config)
-{
-    impl_ = std::make_unique<impl>(workers_per_priority_level, config);
-}
+        auto now = clock::now();
+        for(const auto& kvp : job_priority_queues_)
+        {
+            auto queue_priority_level = kvp.first;
+            if(queue_priority_level < level || kvp.second.empty())
+            {
+                continue;
+            }
+
+            auto job = kvp.second.top();
+            auto steps = static_cast<size_t>((now - job->queued) / aging_interval_);
+            auto effective_level = std::min(size_t(queue_priority_level) + steps, categories_count - 1);
+            if(!found || effective_level > selected_effective_level ||
+               (effective_level == selected_effective_level && job->queued < selected_queued))
+            {
+                selected_level = queue_priority_level;
+                selected_effective_level = effective_level;
+                selected_queued = job->queued;
+                found = true;
+            }
+        }
+        return job_priority_queues_[selected_level];
+    }
+
+    void check_jobs(thread::id worker, priority::category level)
+    {
+        job_helper helper(this, worker, level);
+        auto previous_helper = detail::exchange_wait_helper(&helper);
+
+        job_id finished = 0;
+        while(true)
+        {
+            task user_job;
+            job_id id = 0;
+            std::unique_ptr<promise<void>> done;
+            auto exit = this_thread::notified_for_exit();
+
+            {
+                std::lock_guard<std::mutex> lock(guard_);
+
+                // the finished job is released together with taking
+                // the next one so that a job costs a single lock
+                if(auto job = find_job(finished))
+                {
+                    done = release_job(*job);
+                }
+                if(!exit)
+                {
+                    id = take_job(worker, level, user_job);
+                }
+            }
+
+            if(done)
+            {
+                done->set_value();
+            }
+            if(id == 0)
+            {
+                break;
+            }
+
+            user_job();
+            // released after the call so that the
+            // job is waitable via the pool.
+            finished = id;
+        }
+
+        detail::exchange_wait_helper(previous_helper);
+    }
+
+    // expects guard_ to be locked
+    auto take_job(thread::id worker, priority::category level, task& user_job) -> job_id
+    {
+        auto id = pop_job(level, user_job);
+        if(id == 0)
+        {
+            // checked under the same lock that add_job
+            // uses to pick a worker so no job is missed
+            set_idle(worker, level);
+        }
+        return id;
+    }
+
+    // expects guard_ to be locked
+    auto pop_job(priority::category level, task& user_job) -> job_id
+    {
+        auto& job_queue = select_queue_above(level);
+        if(job_queue.empty())
+        {
+            return 0;
+        }
+
+        // the queues only ever hold pending jobs
+        auto job = job_queue.pop();
+        user_job = std::move(job->callable);
+        if(!job_queue.empty())
+        {
+            note_backlog(job->handle.group.level);
+        }
+        return job->handle.id;
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Runs a job for a worker blocked on a future. Without one the worker
+    /// is woken up for the next job like an idle one.
+    //-----------------------------------------------------------------------------
+    auto help(thread::id worker, priority::category level) -> bool
+    {
+        task user_job;
+        job_id id = 0;
+        {
+            std::lock_guard<std::mutex> lock(guard_);
+            remove_waiting_worker(worker);
+            id = pop_job(level, user_job);
+            if(id == 0)
+            {
+                waiting_workers_.push_back({worker, level});
+                return false;
+            }
+        }
+
+        user_job();
+        clear(id, false);
+        return true;
+    }
+
+    void stop_helping(thread::id worker)
+    {
+        std::lock_guard<std::mutex> lock(guard_);
+        remove_waiting_worker(worker);
+    }
+
+    // expects guard_ to be locked
+    void remove_waiting_worker(thread::id worker)
+    {
+        auto it = std::find_if(std::begin(waiting_workers_),
+                               std::end(waiting_workers_),
+                               [worker](const waiting_worker& waiting)
+                               {
+                                   return waiting.id == worker;
+                               });
+        if(it != std::end(waiting_workers_))
+        {
+            waiting_workers_.erase(it);
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Elastic categories. A supervisor thread spawns and retires their
+    /// workers from timers, so that spawning does not depend on any of
+    /// the workers getting to it while they are all busy.
+    //-----------------------------------------------------------------------------
+    void apply_elastic_config(const thread_pool_config& pool_config, std::map<priority::category, size_t>& counts)
+    {
+        if(pool_config.elastic.empty())
+        {
+            return;
+        }
+
+        for(const auto& kvp : pool_config.elastic)
+        {
+            auto level = kvp.first;
+            auto& category = elastic_[size_t(level)];
+            category.enabled = true;
+            category.min_workers = kvp.second.min_workers;
+            category.max_workers = std::max(kvp.second.max_workers, kvp.second.min_workers);
+
+            auto& count = counts[level];
+            count = std::min(std::max(count, category.min_workers), category.max_workers);
+
+            // the workers of a level serve the jobs of the levels above it
+            for(auto lvl = size_t(level); lvl < categories_count; ++lvl)
+            {
+                elastic_[lvl].tracked = true;
+            }
+        }
+
+        supervisor_ = make_thread("pool_s");
+        supervisor_id_ = supervisor_.get_id();
+    }
+
+    static auto get_worker_name(priority::category level, size_t index) -> std::string
+    {
+        return "pool_w:" + std::to_string(unsigned(level)) + ":" + std::to_string(index);
+    }
+
+    // expects guard_ to be locked
+    void set_idle(thread::id worker, priority::category level)
+    {
+        auto& category = elastic_[size_t(level)];
+        if(!category.tracked)
+        {
+            idle_workers_[level].push_back({worker, {}});
+            return;
+        }
+
+        // nothing above its level is waiting anymore
+        for(auto lvl = size_t(level); lvl < categories_count; ++lvl)
+        {
+            elastic_[lvl].backlog_since = {};
+        }
+
+        if(!category.enabled)
+        {
+            idle_workers_[level].push_back({worker, {}});
+            return;
+        }
+
+        idle_workers_[level].push_back({worker, clock::now()});
+        if(!category.retire_pending && workers_[level].size() > category.min_workers)
+        {
+            schedule_retire_check(level, idle_timeout_);
+        }
+    }
+
+    // expects guard_ to be locked
+    void note_backlog(priority::category level)
+    {
+        auto& category = elastic_[size_t(level)];
+        if(!category.tracked || category.spawn_pending)
+        {
+            return;
+        }
+
+        if(category.backlog_since == clock::time_point{})
+        {
+            category.backlog_since = clock::now();
+        }
+
+        // jobs which no worker can ever take do not wait
+        auto delay = has_workers_for(level) ? spawn_delay_ : clock::duration::zero();
+        schedule_spawn_check(level, delay);
+    }
+
+    // expects guard_ to be locked
+    void schedule_spawn_check(priority::category level, clock::duration delay)
+    {
+        elastic_[size_t(level)].spawn_pending = true;
+        invoke_after(supervisor_id_,
+                     delay,
+                     [this, level]()
+                     {
+                         check_spawn(level);
+                     });
+    }
+
+    // expects guard_ to be locked
+    void schedule_retire_check(priority::category level, clock::duration delay)
+    {
+        elastic_[size_t(level)].retire_pending = true;
+        invoke_after(supervisor_id_,
+                     delay,
+                     [this, level]()
+                     {
+                         check_retire(level);
+                     });
+    }
+
+    // expects guard_ to be locked
+    auto select_category_to_grow(priority::category level, priority::category& grown) const -> bool
+    {
+        // the highest elastic level which can serve the waiting jobs
+        for(auto lvl = size_t(level) + 1; lvl-- > 0;)
+        {
+            auto& category = elastic_[lvl];
+            auto it = workers_.find(priority::category(lvl));
+            auto count = it != workers_.end() ? it->second.size() : 0;
+            if(category.enabled && count < category.max_workers)
+            {
+                grown = priority::category(lvl);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // expects guard_ to be locked
+    auto has_workers_for(priority::category level) const -> bool
+    {
+        for(const auto& kvp : workers_)
+        {
+            if(kvp.first <= level && !kvp.second.empty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Spawns a worker once the jobs of a category have been waiting for
+    /// spawn_delay, and keeps checking every spawn_delay after that while
+    /// they still wait. Runs on the supervisor.
+    //-----------------------------------------------------------------------------
+    void check_spawn(priority::category level)
+    {
+        auto grown = level;
+        std::string name;
+        {
+            std::lock_guard<std::mutex> lock(guard_);
+            auto& category = elastic_[size_t(level)];
+            category.spawn_pending = false;
+
+            auto queue = job_priority_queues_.find(level);
+            if(queue == job_priority_queues_.end() || queue->second.empty() ||
+               category.backlog_since == clock::time_point{})
+            {
+                category.backlog_since = {};
+                return;
+            }
+
+            if(!select_category_to_grow(level, grown))
+            {
+                // at the maximum, a backlog noted from now on checks again
+                return;
+            }
+
+            auto now = clock::now();
+            auto waited = now - category.backlog_since;
+            if(waited < spawn_delay_ && has_workers_for(level))
+            {
+                schedule_spawn_check(level, spawn_delay_ - waited);
+                return;
+            }
+
+            // the next one has to wait for a whole delay again
+            category.backlog_since = now;
+            name = get_worker_name(grown, elastic_[size_t(grown)].next_index++);
+        }
+
+        auto worker = make_thread(name);
+        auto id = worker.get_id();
+        tpp::set_thread_config(id, worker_config_);
+
+        std::lock_guard<std::mutex> lock(guard_);
+        workers_[grown].emplace_back(std::move(worker));
+        job_priority_queues_[grown];
+        ++spawned_count_;
+
+        // it goes idle like any other worker once there are no jobs left
+        invoke(id,
+               [this, id, grown]()
+               {
+                   check_jobs(id, grown);
+               });
+
+        auto& category = elastic_[size_t(level)];
+        if(!category.spawn_pending)
+        {
+            schedule_spawn_check(level, spawn_delay_);
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Retires the workers of a category which have been idle for
+    /// idle_timeout while there are more than the minimum of them.
+    /// Runs on the supervisor.
+    //-----------------------------------------------------------------------------
+    void check_retire(priority::category level)
+    {
+        std::vector<tpp::thread> retired;
+        {
+            std::lock_guard<std::mutex> lock(guard_);
+            auto& category = elastic_[size_t(level)];
+            category.retire_pending = false;
+
+            auto& idle = idle_workers_[level];
+            auto& workers = workers_[level];
+            auto now = clock::now();
+
+            // the ones idle the longest are at the front
+            size_t count = 0;
+            for(; count < idle.size() && workers.size() > category.min_workers; ++count)
+            {
+                if(now - idle[count].since < idle_timeout_)
+                {
+                    break;
+                }
+
+                auto id = idle[count].id;
+                auto it = std::find_if(std::begin(workers),
+                                       std::end(workers),
+                                       [id](const tpp::thread& worker)
+                                       {
+                                           return worker.get_id() == id;
+                                       });
+                retired.emplace_back(std::move(*it));
+                workers.erase(it);
+                ++retired_count_;
+            }
+            idle.erase(std::begin(idle), std::begin(idle) + std::ptrdiff_t(count));
+
+            if(!idle.empty() && workers.size() > category.min_workers)
+            {
+                schedule_retire_check(level, idle.front().since + idle_timeout_ - now);
+            }
+        }
+
+        // idle workers exit as soon as they are notified
+        retired.clear();
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Work stealing scheduler
+    //-----------------------------------------------------------------------------
+    // expects guard_ to be locked
+    auto add_stealing_job(task& user_job, priority::group group) -> stealing_job*
+    {
+        auto& job = acquire_job(group);
+        auto node = new stealing_job();
+        node->id = job.handle.id;
+        node->group = group;
+        node->sequence = job.sequence;
+        node->callable = std::move(user_job);
+
+        job.node = node;
+        return node;
+    }
+
+    void change_stealing_job_priority(job_id id, priority::group group)
+    {
+        stealing_job* requeued = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(guard_);
+
+            auto job = find_job(id);
+            if(job == nullptr || job->handle.group == group || job->node->claimed.exchange(true))
+            {
+                return;
+            }
+
+            // the old node is already queued somewhere, it stays
+            // there claimed and gets released once dequeued
+            requeued = new stealing_job();
+            requeued->id = id;
+            requeued->group = group;
+            requeued->sequence = job->sequence;
+            requeued->callable = std::move(job->node->callable);
+
+            job->handle.group = group;
+            job->node = requeued;
+        }
+
+        enqueue(&requeued, 1, group.level);
+    }
+
+    void enqueue(stealing_job* const* nodes, size_t count, priority::category level)
+    {
+        auto lvl = size_t(level);
+
+        // counted before being published so that an idle worker either
+        // sees the count or gets woken up below
+        queued_[lvl].fetch_add(count, std::memory_order_seq_cst);
+
+        auto self = current_worker_;
+        if(self != nullptr && self->owner == this && self->level == level)
+        {
+            for(size_t i = 0; i < count; ++i)
+            {
+                self->jobs.push(nodes[i]);
+            }
+        }
+        else
+        {
+            auto& queue = injection_[lvl];
+            std::lock_guard<std::mutex> lock(queue.guard);
+            for(size_t i = 0; i < count; ++i)
+            {
+                queue.jobs.push(nodes[i]);
+            }
+            queue.count.fetch_add(count, std::memory_order_release);
+        }
+
+        wake_workers(level, count);
+    }
+
+    void wake_workers(priority::category level, size_t count)
+    {
+        if(idle_count_.load(std::memory_order_seq_cst) == 0)
+        {
+            return;
+        }
+
+        for(auto& worker : stealing_workers_)
+        {
+            if(count == 0)
+            {
+                break;
+            }
+
+            if(worker->level <= level && worker->idle.load(std::memory_order_relaxed) &&
+               worker->idle.exchange(false, std::memory_order_seq_cst))
+            {
+                idle_count_.fetch_sub(1, std::memory_order_relaxed);
+                notify(worker->id);
+                --count;
+            }
+        }
+    }
+
+    auto has_pending_jobs(priority::category level) const -> bool
+    {
+        for(auto lvl = size_t(level); lvl < categories_count; ++lvl)
+        {
+            if(queued_[lvl].load(std::memory_order_seq_cst) > 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(stealing_worker& self)
+    {
+        current_worker_ = &self;
+        stealing_helper helper(this, self);
+        auto previous_helper = detail::exchange_wait_helper(&helper);
+
+        while(!this_thread::notified_for_exit())
+        {
+            if(run_next_job(self))
+            {
+                continue;
+            }
+
+            self.idle.store(true, std::memory_order_seq_cst);
+            idle_count_.fetch_add(1, std::memory_order_seq_cst);
+
+            // a submitter which did not see the idle flag
+            // has already made its job visible to this check
+            if(!has_pending_jobs(self.level))
+            {
+                this_thread::wait();
+            }
+
+            set_busy(self);
+        }
+
+        detail::exchange_wait_helper(previous_helper);
+        current_worker_ = nullptr;
+    }
+
+    void set_busy(stealing_worker& self)
+    {
+        if(self.idle.exchange(false, std::memory_order_seq_cst))
+        {
+            idle_count_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    /// Runs a job for a worker blocked on a future. Without one the worker
+    /// is marked idle so that the next submitter wakes it up.
+    //-----------------------------------------------------------------------------
+    auto help_stealing(stealing_worker& self) -> bool
+    {
+        set_busy(self);
+        if(run_next_job(self))
+        {
+            return true;
+        }
+
+        self.idle.store(true, std::memory_order_seq_cst);
+        idle_count_.fetch_add(1, std::memory_order_seq_cst);
+        return has_pending_jobs(self.level);
+    }
+
+    auto run_next_job(stealing_worker& self) -> bool
+    {
+        // highest category first, same as the shared queue scheduler
+        for(auto lvl = categories_count; lvl-- > size_t(self.level);)
+        {
+            if(queued_[lvl].load(std::memory_order_relaxed) == 0)
+            {
+                continue;
+            }
+
+            stealing_job* node = nullptr;
+            if(lvl == size_t(self.level))
+            {
+                node = self.jobs.pop();
+            }
+            if(node == nullptr)
+            {
+                node = pop_injected(lvl);
+            }
+            if(node == nullptr)
+            {
+                node = steal(self, lvl);
+            }
+
+            if(node != nullptr)
+            {
+                queued_[lvl].fetch_sub(1, std::memory_order_relaxed);
+                execute(node);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    auto pop_injected(size_t lvl) -> stealing_job*
+    {
+        auto& queue = injection_[lvl];
+        if(queue.count.load(std::memory_order_acquire) == 0)
+        {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(queue.guard);
+        if(queue.jobs.empty())
+        {
+            return nullptr;
+        }
+        auto node = queue.jobs.top();
+        queue.jobs.pop();
+        queue.count.fetch_sub(1, std::memory_order_relaxed);
+        return node;
+    }
+
+    auto steal(stealing_worker& self, size_t lvl) -> stealing_job*
+    {
+        // xorshift to spread the thieves over the victims
+        self.seed ^= self.seed << 13;
+        self.seed ^= self.seed >> 17;
+        self.seed ^= self.seed << 5;
+
+        auto count = stealing_workers_.size();
+        auto start = size_t(self.seed) % count;
+        for(size_t i = 0; i < count; ++i)
+        {
+            auto& victim = *stealing_workers_[(start + i) % count];
+            if(&victim == &self || size_t(victim.level) != lvl)
+            {
+                continue;
+            }
+
+            if(auto node = victim.jobs.steal())
+            {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    void execute(stealing_job* node)
+    {
+        std::unique_ptr<stealing_job> job(node);
+        if(job->claimed.exchange(true))
+        {
+            // stopped or requeued. A requeue moves the callable out
+            // under the guard, wait for it before releasing the node
+            std::lock_guard<std::mutex> lock(guard_);
+            return;
+        }
+
+        job->callable();
+        // clear after the call so that the task
+        // is waitable via the pool.
+        clear(job->id, false);
+    }
+
+    mutable std::mutex guard_;
+    job_id id_generator_ = 0;
+    std::uint64_t sequence_ = 0;
+    scheduler_type scheduler_{};
+
+    scheduling_policy policy_{};
+    std::array<size_t, categories_count> weights_{};
+    std::array<std::uint64_t, categories_count> passes_{};
+    std::uint64_t virtual_time_ = 0;
+    clock::duration aging_interval_{};
+    std::int64_t max_rank_priority_{};
+    clock::time_point epoch_ = clock::now();
+
+    std::array<elastic_category, categories_count> elastic_{};
+    clock::duration spawn_delay_{};
+    clock::duration idle_timeout_{};
+    tasks_capacity_config worker_config_{};
+    size_t spawned_count_ = 0;
+    size_t retired_count_ = 0;
+    tpp::thread supervisor_;
+    thread::id supervisor_id_{};
+
+    std::vector<std::unique_ptr<stealing_worker>> stealing_workers_;
+    std::array<injection_queue, categories_count> injection_;
+    std::array<std::atomic<size_t>, categories_count> queued_{};
+    std::atomic<size_t> idle_count_{0};
+
+    static thread_local stealing_worker* current_worker_;
+
+    priority_workers workers_;
+    std::map<priority::category, std::vector<idle_worker>> idle_workers_;
+    std::vector<waiting_worker> waiting_workers_;
+    // a deque so that the queues can point to the jobs
+    std::deque<job_info> jobs_;
+    std::vector<size_t> free_slots_;
+    size_t jobs_count_ = 0;
+    priority_queues job_priority_queues_;
+};
+
+thread_local thread_pool::impl::stealing_worker* thread_pool::impl::current_worker_ = nullptr;
+
+////////////////////////////////////////////////////////////
+thread_pool::thread_pool() : thread_pool({{priority::category::normal, thread::hardware_concurrency()}})
+{
+}
+thread_pool::thread_pool(const std::map<priority::category, size_t>& workers_per_priority_level,
+                         tasks_capacity_config config,
+                         thread_pool_config pool_config)
+{
+    impl_ = std::make_unique<impl>(workers_per_priority_level, config, pool_config);
+}
 
 thread_pool::~thread_pool() = default;
 
@@ -303,6 +1486,11 @@ job_id thread_pool::add_job(task& job, priority::group group)
     return impl_->add_job(job, group);
 }
 
+void thread_pool::add_jobs(task* jobs, size_t count, priority::group group, job_id* ids)
+{
+    impl_->add_jobs(jobs, count, group, ids);
+}
+
 void thread_pool::change_priority(job_id id, priority::group group)
 {
     impl_->change_priority(id, group);
@@ -333,6 +1521,26 @@ size_t thread_pool::get_jobs_count() const
     return impl_->get_jobs_count();
 }
 
+size_t thread_pool::get_workers_count() const
+{
+    return impl_->get_workers_count();
+}
+
+size_t thread_pool::get_workers_count(priority::category level) const
+{
+    return impl_->get_workers_count(level);
+}
+
+size_t thread_pool::get_spawned_workers_count() const
+{
+    return impl_->get_spawned_workers_count();
+}
+
+size_t thread_pool::get_retired_workers_count() const
+{
+    return impl_->get_retired_workers_count();
+}
+
 void job_future_storage::change_priority(priority::group group)
 {
     if(sentinel_.expired())
@@ -1,55 +1,88 @@
 #pragma once
 
 #include "future.hpp"
+#include "priority.h"
+#include <array>
+#include <chrono>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <vector>
 
 namespace tpp
 {
 
-namespace priority
-{
+using job_id = uint64_t;
+class thread_pool;
 
-enum class category : size_t
+//-----------------------------------------------------------------------------
+/// How jobs are distributed among the workers of a thread_pool.
+//-----------------------------------------------------------------------------
+enum class scheduler_type
 {
-    normal,
-    high,
-    critical
+    /// Shared priority queue per category. Workers are notified via their
+    /// task queues and the priority within a category is honored.
+    shared_queue,
+
+    /// Each worker owns a deque. Jobs scheduled from a worker are pushed to its
+    /// own deque and popped LIFO while idle workers steal them FIFO. Jobs from
+    /// any other thread go through a shared injection queue per category.
+    /// Categories are honored the same way. The priority within a category
+    /// only orders the injection queues.
+    work_stealing
 };
 
-struct group
+//-----------------------------------------------------------------------------
+/// How a worker picks among the categories it serves. Jobs of the same
+/// category are taken by their priority and in the order they were
+/// scheduled when equal. Applies to the shared queue scheduler.
+/// Priorities above INT64_MAX, or with aging above INT64_MAX divided by
+/// the aging_interval in clock ticks, are treated as that maximum.
+//-----------------------------------------------------------------------------
+enum class scheduling_policy
 {
-    group() = default;
-    group(category c, size_t pr) : level(c), priority(pr)
-    {
-    }
-
-    category level = category::normal;
-    size_t priority = 0;
+    /// Always the highest non empty category. A steady stream of higher
+    /// category jobs starves the lower ones.
+    strict,
+
+    /// Each non empty category gets a share of the jobs proportional to
+    /// its weight, so the lower ones keep making progress.
+    weighted_fair,
+
+    /// Waiting jobs gain a priority level every aging_interval, and cross
+    /// into the next category every aging_interval as well, so no job
+    /// waits forever behind newer ones.
+    aging
 };
 
-inline auto operator==(const group& lhs, const group& rhs) -> bool
+//-----------------------------------------------------------------------------
+/// Bounds on the workers of an elastic category.
+//-----------------------------------------------------------------------------
+struct elastic_workers
 {
-    return lhs.level == rhs.level && lhs.priority == rhs.priority;
-}
+    size_t min_workers{0};
+    size_t max_workers{thread::hardware_concurrency()};
+};
 
-inline auto normal(size_t priority = 0) -> group
-{
-    return {category::normal, priority};
-}
-inline auto high(size_t priority = 0) -> group
-{
-    return {category::high, priority};
-}
-inline auto critical(size_t priority = 0) -> group
+struct thread_pool_config
 {
-    return {category::critical, priority};
-}
-
-} // namespace priority
-
-using job_id = uint64_t;
-class thread_pool;
+    scheduler_type scheduler{scheduler_type::shared_queue};
+    scheduling_policy policy{scheduling_policy::strict};
+
+    // weighted_fair only, indexed by the priority::category
+    std::array<size_t, priority::categories_count> weights{{1, 4, 16}};
+
+    // aging only
+    std::chrono::milliseconds aging_interval{std::chrono::milliseconds(100)};
+
+    // shared_queue only. The listed categories start with the workers
+    // requested for them kept within the bounds. They spawn a worker every
+    // spawn_delay for as long as their jobs keep waiting for one, and retire
+    // the workers which were idle for idle_timeout down to the minimum.
+    std::map<priority::category, elastic_workers> elastic;
+    std::chrono::milliseconds spawn_delay{std::chrono::milliseconds(10)};
+    std::chrono::milliseconds idle_timeout{std::chrono::seconds(10)};
+};
 
 struct job_future_storage
 {
@@ -143,7 +176,8 @@ public:
     ///					       {tpp::priority::category::critical, 1}});
     //-----------------------------------------------------------------------------
     thread_pool(const std::map<priority::category, size_t>& workers_per_priority_level,
-                tasks_capacity_config config = {});
+                tasks_capacity_config config = {},
+                thread_pool_config pool_config = {});
     thread_pool();
     thread_pool(thread_pool&&) = default;
     auto operator=(thread_pool&&) -> thread_pool& = default;
@@ -166,6 +200,15 @@ public:
     template<typename F, typename... Args>
     auto schedule(F&& f, Args&&... args) -> job_future<job_ret_type<F, Args...>>;
 
+    //-----------------------------------------------------------------------------
+    /// Adds a batch of jobs for a certain priority level under a single
+    /// lock and worker notification.
+    /// Returns a future per job in the order of the input.
+    //-----------------------------------------------------------------------------
+    template<typename InputIt>
+    auto schedule_bulk(priority::group group, InputIt first, InputIt last)
+        -> std::vector<job_future<job_ret_type<typename std::iterator_traits<InputIt>::reference>>>;
+
     //-----------------------------------------------------------------------------
     /// Changes the priority level of the specified job.
     /// Increasing the priority will cause the job to be executed sooner.
@@ -202,8 +245,26 @@ public:
     //-----------------------------------------------------------------------------
     auto get_jobs_count() const -> size_t;
 
+    //-----------------------------------------------------------------------------
+    /// Returns the number of worker threads.
+    //-----------------------------------------------------------------------------
+    auto get_workers_count() const -> size_t;
+
+    //-----------------------------------------------------------------------------
+    /// Returns the number of worker threads of a priority level.
+    //-----------------------------------------------------------------------------
+    auto get_workers_count(priority::category level) const -> size_t;
+
+    //-----------------------------------------------------------------------------
+    /// Returns the number of workers spawned and retired by the elastic
+    /// categories so far.
+    //-----------------------------------------------------------------------------
+    auto get_spawned_workers_count() const -> size_t;
+    auto get_retired_workers_count() const -> size_t;
+
 private:
     auto add_job(task& job, priority::group group) -> job_id;
+    void add_jobs(task* jobs, size_t count, priority::group group, job_id* ids);
 
     class impl;
     /// pimpl idiom
@@ -229,4 +290,30 @@ auto thread_pool::schedule(F&& f, Args&&... args) -> job_future<job_ret_type<F,
     return schedule(priority::normal(), std::forward<F>(f), std::forward<Args>(args)...);
 }
 
+template<typename InputIt>
+auto thread_pool::schedule_bulk(priority::group group, InputIt first, InputIt last)
+    -> std::vector<job_future<job_ret_type<typename std::iterator_traits<InputIt>::reference>>>
+{
+    using return_type = job_ret_type<typename std::iterator_traits<InputIt>::reference>;
+
+    std::vector<job_future<return_type>> futures;
+    std::vector<task> jobs;
+    for(; first != last; ++first)
+    {
+        auto packaged_task = detail::package_future_task(*first);
+        futures.emplace_back(std::move(packaged_task.callable_future));
+        jobs.emplace_back(std::move(packaged_task.callable));
+    }
+
+    std::vector<job_id> ids(jobs.size());
+    add_jobs(jobs.data(), jobs.size(), group, ids.data());
+    for(size_t i = 0; i < futures.size(); ++i)
+    {
+        futures[i].id = ids[i];
+        futures[i].sentinel_ = sentinel_;
+        futures[i].owner_ = this;
+    }
+    return futures;
+}
+
 } // namespace tpp
@@ -1,11 +1,21 @@
 #pragma once
 #include "future.hpp"
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
 #include <type_traits>
+#include <vector>
 
 namespace tpp
 {
 
+namespace detail
+{
+template<typename Future>
+using future_value_type = std::decay_t<decltype(std::declval<Future&>().get())>;
+} // namespace detail
+
 template<typename Sequence>
 struct when_any_result
 {
@@ -28,6 +38,16 @@ auto when_all(Futures&&... futures) -> future<std::tuple<std::decay_t<Futures>..
 template<class InputIt>
 auto when_all(InputIt first, InputIt last) -> future<std::vector<typename std::iterator_traits<InputIt>::value_type>>;
 
+//-----------------------------------------------------------------------------
+/// Create a future object that becomes ready when all of the input
+/// futures and shared_futures become ready and holds their values in
+/// input order. If any input holds an exception the first one in input
+/// order is propagated instead.
+//-----------------------------------------------------------------------------
+template<class InputIt>
+auto when_all_values(InputIt first, InputIt last)
+    -> future<std::vector<detail::future_value_type<typename std::iterator_traits<InputIt>::value_type>>>;
+
 //-----------------------------------------------------------------------------
 /// Create a future object that becomes ready when at least one
 /// of the input futures and shared_futures become ready.
@@ -57,70 +77,6 @@ void visit_at(Tuple&& tup, size_t idx, F&& f);
 namespace detail
 {
 
-template<size_t I, typename Context>
-void when_any_inner_helper(Context context)
-{
-    using ith_future_type = std::decay_t<decltype(std::get<I>(context->result.futures))>;
-    auto id = this_thread::get_id();
-
-    std::get<I>(context->result.futures)
-        .then(id,
-              [context](ith_future_type f)
-              {
-                  std::lock_guard<std::mutex> lock(context->mutex);
-                  if(!context->ready)
-                  {
-                      context->ready = true;
-                      context->result.index = I;
-                      std::get<I>(context->result.futures) = std::move(f);
-                      if(context->processed == context->total && !context->result_moved)
-                      {
-                          context->recover_input_futures();
-                          context->p.set_value(std::move(context->result));
-                          context->result_moved = true;
-                      }
-                  }
-              });
-}
-
-template<size_t I, size_t S>
-struct when_any_helper_struct
-{
-    template<typename Context, typename... Futures>
-    static void apply(const Context& context, std::tuple<Futures...>& t)
-    {
-        when_any_inner_helper<I>(context);
-        ++context->processed;
-        when_any_helper_struct<I + 1, S>::apply(context, t);
-    }
-
-    template<typename... Futures, typename... States>
-    static void recover(std::tuple<Futures...>& t, std::tuple<States...>& s)
-    {
-        static_assert(sizeof...(Futures) == sizeof...(States), "Sizes mismatch");
-        auto& f = std::get<I>(t);
-        if(!f.valid())
-        {
-            f._internal_set_state(std::get<I>(s));
-        }
-        when_any_helper_struct<I + 1, S>::recover(t, s);
-    }
-};
-
-template<size_t S>
-struct when_any_helper_struct<S, S>
-{
-    template<typename Context, typename... Futures>
-    static void apply(const Context& /*unused*/, std::tuple<Futures...>& /*unused*/)
-    {
-    }
-
-    template<typename... Futures, typename... States>
-    static void recover(std::tuple<Futures...>& /*unused*/, std::tuple<States...>& /*unused*/)
-    {
-    }
-};
-
 template<size_t I, typename Context>
 void fill_result_helper(const Context& /*unused*/)
 {
@@ -147,7 +103,6 @@ template<size_t I, typename Context, typename FirstFuture, typename... Futures>
 void fill_result_helper(const Context& context, FirstFuture&& f, Futures&&... fs)
 {
     std::get<I>(context->result.futures) = copy_or_move(std::forward<FirstFuture>(f));
-    std::get<I>(context->states) = std::get<I>(context->result.futures)._internal_get_state();
 
     fill_result_helper<I + 1>(context, std::forward<Futures>(fs)...);
 }
@@ -184,6 +139,133 @@ void apply_helper(const Context& context, FirstFuture&& f, Futures&&... fs)
     apply_helper<I + 1>(context, std::forward<Futures>(fs)...);
 }
 
+//-----------------------------------------------------------------------------
+/// Stores the input futures in context->result and registers a completion
+/// callback directly on each shared state. No promise or future is created
+/// per input and a single continuation does not allocate.
+//-----------------------------------------------------------------------------
+template<typename Context, typename InputIt>
+void when_all_attach(const std::shared_ptr<Context>& context, InputIt first, InputIt last)
+{
+    auto total = static_cast<size_t>(std::distance(first, last));
+
+    // one extra count held while attaching so that a completion
+    // cannot finish the result before every input is stored
+    context->remaining = total + 1;
+    context->result.reserve(total);
+    for(; first != last; ++first)
+    {
+        context->result.emplace_back(copy_or_move(*first));
+    }
+
+    for(const auto& f : context->result)
+    {
+        auto& state = f._internal_get_state();
+        check_state(state);
+        state->set_continuation(
+            [context]()
+            {
+                context->on_ready();
+            });
+    }
+
+    context->on_ready();
+}
+
+template<typename Future, typename F>
+void for_each_future(std::vector<Future>& futures, F&& f)
+{
+    for(size_t i = 0; i < futures.size(); ++i)
+    {
+        f(futures[i], i);
+    }
+}
+
+template<typename... Futures, typename F, size_t... Is>
+void for_each_future(std::tuple<Futures...>& futures, F&& f, std::index_sequence<Is...> /*unused*/)
+{
+    using expander = int[];
+    (void)expander{0, (f(std::get<Is>(futures), Is), 0)...};
+}
+
+template<typename... Futures, typename F>
+void for_each_future(std::tuple<Futures...>& futures, F&& f)
+{
+    for_each_future(futures, std::forward<F>(f), std::index_sequence_for<Futures...>{});
+}
+
+//-----------------------------------------------------------------------------
+/// Shared by the continuations when_any attaches to its inputs. The first
+/// ready input wins with a single exchange. Once the winner is known and
+/// all inputs are attached the losers' continuations are cancelled, so
+/// they neither run nor keep this context alive.
+//-----------------------------------------------------------------------------
+template<typename Sequence>
+struct when_any_context
+{
+    explicit when_any_context(size_t count) : handles(count)
+    {
+    }
+
+    void on_ready(size_t index)
+    {
+        if(!chosen.exchange(true, std::memory_order_acq_rel))
+        {
+            result.index = index;
+            complete();
+        }
+    }
+
+    // called by the winner and once attaching is done, the last one finishes
+    void complete()
+    {
+        if(gate.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        {
+            return;
+        }
+
+        for_each_future(result.futures,
+                        [this](auto& f, size_t index)
+                        {
+                            if(handles[index] != nullptr)
+                            {
+                                f._internal_get_state()->cancel_continuation(handles[index]);
+                            }
+                        });
+        p.set_value(std::move(result));
+    }
+
+    std::atomic<bool> chosen{false};
+    std::atomic<int> gate{2};
+    when_any_result<Sequence> result;
+    std::vector<continuation_node*> handles;
+    promise<when_any_result<Sequence>> p;
+};
+
+template<typename Context>
+void when_any_attach(const std::shared_ptr<Context>& context)
+{
+    for_each_future(context->result.futures,
+                    [&context](auto& f, size_t index)
+                    {
+                        // no need to attach to the rest once there is a winner
+                        if(context->chosen.load(std::memory_order_acquire))
+                        {
+                            return;
+                        }
+
+                        const auto& state = f._internal_get_state();
+                        check_state(state);
+                        context->handles[index] = state->set_cancellable_continuation(
+                            [context, index]()
+                            {
+                                context->on_ready(index);
+                            });
+                    });
+
+    context->complete();
+}
+
 template<size_t I>
 struct visit_impl
 {
@@ -220,38 +302,76 @@ auto when_all(InputIt first, InputIt last) -> future<std::vector<typename std::i
     {
         return make_ready_future(result_inner_type{});
     }
+
     struct context
     {
-        size_t total_futures = 0;
-        size_t ready_futures = 0;
+        std::atomic<size_t> remaining{0};
         result_inner_type result;
-        std::mutex mutex;
         promise<result_inner_type> p;
+
+        void on_ready()
+        {
+            if(remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                p.set_value(std::move(result));
+            }
+        }
     };
 
     auto shared_context = std::make_shared<context>();
     auto result_future = shared_context->p.get_future();
-    shared_context->total_futures = std::distance(first, last);
-    shared_context->result.reserve(shared_context->total_futures);
-    size_t index = 0;
-    auto id = this_thread::get_id();
+    detail::when_all_attach(shared_context, first, last);
+    return result_future;
+}
+
+template<typename InputIt>
+auto when_all_values(InputIt first, InputIt last)
+    -> future<std::vector<detail::future_value_type<typename std::iterator_traits<InputIt>::value_type>>>
+{
+    using future_type = typename std::iterator_traits<InputIt>::value_type;
+    using value_type = detail::future_value_type<future_type>;
+    using result_inner_type = std::vector<value_type>;
+    static_assert(!std::is_void<value_type>::value, "when_all_values needs futures with a value, use when_all");
 
-    for(; first != last; ++first, ++index)
+    if(first == last)
     {
-        shared_context->result.emplace_back(copy_or_move(*first));
-        shared_context->result[index].then(id,
-                                           [shared_context, index](auto f)
-                                           {
-                                               std::lock_guard<std::mutex> lock(shared_context->mutex);
-                                               shared_context->result[index] = std::move(f);
-                                               ++shared_context->ready_futures;
-                                               if(shared_context->ready_futures == shared_context->total_futures)
-                                               {
-                                                   shared_context->p.set_value(std::move(shared_context->result));
-                                               }
-                                           });
+        return make_ready_future(result_inner_type{});
     }
 
+    struct context
+    {
+        std::atomic<size_t> remaining{0};
+        std::vector<future_type> result;
+        promise<result_inner_type> p;
+
+        void on_ready()
+        {
+            if(remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            {
+                return;
+            }
+
+            try
+            {
+                result_inner_type values;
+                values.reserve(result.size());
+                for(auto& f : result)
+                {
+                    values.emplace_back(f.get());
+                }
+                p.set_value(std::move(values));
+            }
+            catch(...)
+            {
+                // the first failed input in order
+                p.set_exception(std::current_exception());
+            }
+        }
+    };
+
+    auto shared_context = std::make_shared<context>();
+    auto result_future = shared_context->p.get_future();
+    detail::when_all_attach(shared_context, first, last);
     return result_future;
 }
 
@@ -283,7 +403,6 @@ auto when_any(InputIt first, InputIt last)
     -> future<when_any_result<std::vector<typename std::iterator_traits<InputIt>::value_type>>>
 {
     using value_type = typename std::iterator_traits<InputIt>::value_type;
-    using future_state_inner_type = std::vector<typename value_type::state_type>;
     using result_inner_type = std::vector<value_type>;
     using future_inner_type = when_any_result<result_inner_type>;
 
@@ -292,76 +411,16 @@ auto when_any(InputIt first, InputIt last)
         return make_ready_future(future_inner_type{});
     }
 
-    struct context
-    {
-        size_t total = 0;
-        std::atomic<size_t> processed;
-        future_inner_type result;
-        future_state_inner_type states;
-        promise<future_inner_type> p;
-        bool ready = false;
-        bool promise_set = false;
-        std::mutex mutex;
-
-        void recover_input_futures()
-        {
-            for(size_t i = 0; i < result.futures.size(); ++i)
-            {
-                auto& f = result.futures[i];
-                auto state = states[i];
-                if(!f.valid())
-                {
-                    f._internal_set_state(state);
-                }
-            }
-        }
-    };
-
-    auto shared_context = std::make_shared<context>();
-    auto result_future = shared_context->p.get_future();
-    shared_context->processed = 0;
-    shared_context->total = std::distance(first, last);
-    shared_context->result.futures.reserve(shared_context->total);
-    shared_context->states.reserve(shared_context->total);
-
-    size_t index = 0;
-
-    auto id = this_thread::get_id();
-    for(; first != last; ++first, ++index)
+    auto count = static_cast<size_t>(std::distance(first, last));
+    auto shared_context = std::make_shared<detail::when_any_context<result_inner_type>>(count);
+    shared_context->result.futures.reserve(count);
+    for(; first != last; ++first)
     {
         shared_context->result.futures.emplace_back(copy_or_move(*first));
-        shared_context->states.emplace_back(shared_context->result.futures[index]._internal_get_state());
-        shared_context->result.futures[index].then(
-            id,
-            [shared_context, index](auto f)
-            {
-                std::lock_guard<std::mutex> lock(shared_context->mutex);
-                if(!shared_context->ready)
-                {
-                    shared_context->result.index = index;
-                    shared_context->ready = true;
-                    shared_context->result.futures[index] = std::move(f);
-                    if(shared_context->processed == shared_context->total && !shared_context->promise_set)
-                    {
-                        shared_context->recover_input_futures();
-                        shared_context->p.set_value(std::move(shared_context->result));
-                        shared_context->promise_set = true;
-                    }
-                }
-            });
-        ++shared_context->processed;
-    }
-
-    {
-        std::lock_guard<std::mutex> lock(shared_context->mutex);
-        if(shared_context->ready && !shared_context->promise_set)
-        {
-            shared_context->recover_input_futures();
-            shared_context->p.set_value(std::move(shared_context->result));
-            shared_context->promise_set = true;
-        }
     }
 
+    auto result_future = shared_context->p.get_future();
+    detail::when_any_attach(shared_context);
     return result_future;
 }
 inline auto when_any() -> future<when_any_result<std::tuple<>>>
@@ -375,42 +434,13 @@ template<typename... Futures>
 auto when_any(Futures&&... futures) -> future<when_any_result<std::tuple<std::decay_t<Futures>...>>>
 {
     using result_inner_type = std::tuple<std::decay_t<Futures>...>;
-    using future_state_inner_type = std::tuple<typename std::decay_t<Futures>::state_type...>;
-    using future_inner_type = when_any_result<result_inner_type>;
-    constexpr static const auto sz_futures = sizeof...(futures);
-    struct context
-    {
-        bool ready = false;
-        bool result_moved = false;
-        size_t total = 0;
-        std::atomic<size_t> processed;
-        future_inner_type result;
-        future_state_inner_type states;
-        promise<future_inner_type> p;
-        std::mutex mutex;
-
-        void recover_input_futures()
-        {
-            detail::when_any_helper_struct<0, sz_futures>::recover(result.futures, states);
-        }
-    };
-
-    auto shared_context = std::make_shared<context>();
-    shared_context->processed = 0;
-    shared_context->total = sz_futures;
 
+    auto shared_context = std::make_shared<detail::when_any_context<result_inner_type>>(sizeof...(futures));
     detail::fill_result_helper<0>(shared_context, std::forward<Futures>(futures)...);
-    detail::when_any_helper_struct<0, sz_futures>::apply(shared_context, shared_context->result.futures);
-    {
-        std::lock_guard<std::mutex> lock(shared_context->mutex);
-        if(shared_context->ready && !shared_context->result_moved)
-        {
-            shared_context->recover_input_futures();
-            shared_context->p.set_value(std::move(shared_context->result));
-            shared_context->result_moved = true;
-        }
-    }
-    return shared_context->p.get_future();
+
+    auto result_future = shared_context->p.get_future();
+    detail::when_any_attach(shared_context);
+    return result_future;
 }
 
 template<typename Tuple, typename F>